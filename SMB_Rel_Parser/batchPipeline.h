@@ -0,0 +1,337 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "relFile.h"
+
+namespace RELPatch {
+
+	// Not in the actual specs
+	typedef struct BatchJob {
+		std::string inputPath;				// Rel file to read
+		std::string outputPath;				// Where the processed rel file is written (can be the same as inputPath)
+	}BatchJob;
+
+	// Not in the actual specs
+	typedef struct StageStatistics {
+		uint64_t items;						// Number of rel files that went through the stage
+		uint64_t bytes;						// Number of bytes of those rel files
+		double busySeconds;					// Time the stage's threads spent working (summed over the threads)
+		double bytesPerSecond;				// <bytes> divided by the wall clock time of the whole run
+	}StageStatistics;
+
+	// Not in the actual specs
+	typedef struct BatchReport {
+		StageStatistics read;				// Reading the rel files
+		StageStatistics process;			// Parsing and running the processing function
+		StageStatistics write;				// Writing the results
+		uint32_t failed;					// Rel files that couldn't be read or written or whose processing function threw
+		uint32_t skipped;					// Rel files the processing function didn't want written
+		uint64_t peakBytesInFlight;			// Largest number of rel file bytes held in memory at once
+		double wallSeconds;					// Wall clock time of the whole run
+	}BatchReport;
+
+	/*
+		Queue that blocks pushes when <capacity> items are waiting and blocks pops when it's empty
+		Pops return false once the queue has been closed and emptied
+	*/
+	template <typename T>
+	class BoundedQueue {
+	public:
+		BoundedQueue(size_t maxItems) : capacity(maxItems), closed(false) {
+		}
+
+		void push(T item) {
+			std::unique_lock<std::mutex> lock(queueLock);
+			notFull.wait(lock, [this]() { return items.size() < capacity; });
+			items.push_back(std::move(item));
+			notEmpty.notify_one();
+		}
+
+		bool pop(T &item) {
+			std::unique_lock<std::mutex> lock(queueLock);
+			notEmpty.wait(lock, [this]() { return !items.empty() || closed; });
+			if (items.empty()) {
+				return false;
+			}
+			item = std::move(items.front());
+			items.pop_front();
+			notFull.notify_one();
+			return true;
+		}
+
+		/*
+			Wakes up every waiting pop once the queue runs empty
+		*/
+		void close() {
+			std::lock_guard<std::mutex> lock(queueLock);
+			closed = true;
+			notEmpty.notify_all();
+		}
+
+	private:
+		size_t capacity;
+		bool closed;
+		std::deque<T> items;
+		std::mutex queueLock;
+		std::condition_variable notEmpty;
+		std::condition_variable notFull;
+	};
+
+	/*
+		Runs a function over many rel files with reading, processing and writing overlapped
+		I/O threads read the next rel files ahead of time and write finished ones behind while the processing threads work on the current ones
+		The stages are connected by bounded queues and the total size of the rel files held in memory is kept under a budget
+		(a single rel file larger than the budget is still let through on its own)
+	*/
+	class BatchPipeline {
+	public:
+		typedef std::function<bool(RELFile&)> ProcessFunction;
+
+		BatchPipeline(uint64_t bytesInFlightLimit = 256 * 1024 * 1024, uint32_t ioThreadCount = 4, uint32_t processThreadCount = 0)
+			: maxBytesInFlight(bytesInFlightLimit), ioThreads(ioThreadCount == 0 ? 1 : ioThreadCount), processThreads(processThreadCount) {
+			if (this->processThreads == 0) {
+				this->processThreads = std::max(1u, std::thread::hardware_concurrency());
+			}
+		}
+
+		/*
+			Reads every job's input, calls <process> on it and writes it to the job's output if <process> returns true
+			Rel files are opened from memory (see RELFile's image constructor) so nothing is written to the input while processing
+			An exception thrown for one rel file (by <process> or while reading or writing it) counts it as failed and the run goes on
+		*/
+		BatchReport run(std::vector<BatchJob> const& jobs, ProcessFunction process) {
+			Run state(jobs, process, ioThreads + processThreads);
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+			std::vector<std::thread> readers, processors, writers;
+			for (uint32_t i = 0; i < ioThreads; i++) {
+				readers.push_back(std::thread(&BatchPipeline::readStage, this, std::ref(state)));
+				writers.push_back(std::thread(&BatchPipeline::writeStage, this, std::ref(state)));
+			}
+			for (uint32_t i = 0; i < processThreads; i++) {
+				processors.push_back(std::thread(&BatchPipeline::processStage, this, std::ref(state)));
+			}
+
+			joinAll(readers);
+			state.readQueue.close();
+			joinAll(processors);
+			state.writeQueue.close();
+			joinAll(writers);
+
+			BatchReport report;
+			report.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			report.read = statistics(state.read, report.wallSeconds);
+			report.process = statistics(state.process, report.wallSeconds);
+			report.write = statistics(state.write, report.wallSeconds);
+			report.failed = state.failed.load();
+			report.skipped = state.skipped.load();
+			report.peakBytesInFlight = state.peakBytesInFlight;
+			return report;
+		}
+
+	private:
+		uint64_t maxBytesInFlight;
+		uint32_t ioThreads;
+		uint32_t processThreads;
+
+		typedef struct StageCounters {
+			std::atomic<uint64_t> items;
+			std::atomic<uint64_t> bytes;
+			std::atomic<uint64_t> busyNanoseconds;
+		}StageCounters;
+
+		typedef struct ReadItem {
+			size_t job;
+			std::vector<char> image;
+		}ReadItem;
+
+		typedef struct WriteItem {
+			size_t job;
+			uint64_t size;
+			std::unique_ptr<RELFile> relFile;
+		}WriteItem;
+
+		// Everything shared by the threads of one run
+		struct Run {
+			std::vector<BatchJob> const& jobs;
+			ProcessFunction processFunction;
+			std::atomic<size_t> nextJob;
+			BoundedQueue<ReadItem> readQueue;
+			BoundedQueue<WriteItem> writeQueue;
+			StageCounters read;
+			StageCounters process;
+			StageCounters write;
+			std::atomic<uint32_t> failed;
+			std::atomic<uint32_t> skipped;
+
+			// Bytes of rel files between the start of their read and the end of their write
+			std::mutex budgetLock;
+			std::condition_variable budgetFreed;
+			uint64_t bytesInFlight;
+			uint64_t peakBytesInFlight;
+
+			Run(std::vector<BatchJob> const& jobList, ProcessFunction function, size_t queueCapacity)
+				: jobs(jobList), processFunction(function), nextJob(0), readQueue(queueCapacity), writeQueue(queueCapacity), failed(0), skipped(0), bytesInFlight(0), peakBytesInFlight(0) {
+				resetCounters(read);
+				resetCounters(process);
+				resetCounters(write);
+			}
+		};
+
+		static void resetCounters(StageCounters &counters) {
+			counters.items = 0;
+			counters.bytes = 0;
+			counters.busyNanoseconds = 0;
+		}
+
+		static void joinAll(std::vector<std::thread> &threads) {
+			for (size_t i = 0; i < threads.size(); i++) {
+				threads[i].join();
+			}
+		}
+
+		static StageStatistics statistics(StageCounters const& counters, double wallSeconds) {
+			StageStatistics stage;
+			stage.items = counters.items.load();
+			stage.bytes = counters.bytes.load();
+			stage.busySeconds = counters.busyNanoseconds.load() / 1e9;
+			stage.bytesPerSecond = wallSeconds > 0 ? stage.bytes / wallSeconds : 0;
+			return stage;
+		}
+
+		static void count(StageCounters &counters, uint64_t bytes, std::chrono::steady_clock::time_point start) {
+			counters.items += 1;
+			counters.bytes += bytes;
+			counters.busyNanoseconds += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		/*
+			Waits until <size> more bytes fit in the budget (or nothing else is in flight) and takes them
+		*/
+		void acquire(Run &state, uint64_t size) {
+			std::unique_lock<std::mutex> lock(state.budgetLock);
+			state.budgetFreed.wait(lock, [this, &state, size]() {
+				return state.bytesInFlight == 0 || state.bytesInFlight + size <= maxBytesInFlight;
+			});
+			state.bytesInFlight += size;
+			state.peakBytesInFlight = std::max(state.peakBytesInFlight, state.bytesInFlight);
+		}
+
+		void release(Run &state, uint64_t size) {
+			std::lock_guard<std::mutex> lock(state.budgetLock);
+			state.bytesInFlight -= size;
+			state.budgetFreed.notify_all();
+		}
+
+		/*
+			Changes a rel file's share of the budget from <oldSize> to <newSize> once processing changed its size
+			Growth is taken without waiting (waiting here could block the stages that free the budget), reads wait until it's freed again
+		*/
+		void resize(Run &state, uint64_t oldSize, uint64_t newSize) {
+			std::lock_guard<std::mutex> lock(state.budgetLock);
+			state.bytesInFlight = state.bytesInFlight - oldSize + newSize;
+			state.peakBytesInFlight = std::max(state.peakBytesInFlight, state.bytesInFlight);
+			if (newSize < oldSize) {
+				state.budgetFreed.notify_all();
+			}
+		}
+
+		void readStage(Run &state) {
+			for (size_t job = state.nextJob++; job < state.jobs.size(); job = state.nextJob++) {
+				std::ifstream input(state.jobs[job].inputPath, std::ios::binary | std::ios::ate);
+				if (!input.is_open()) {
+					state.failed += 1;
+					continue;
+				}
+				uint64_t size = (uint64_t)input.tellg();
+				acquire(state, size);
+
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				ReadItem item;
+				item.job = job;
+				try {
+					item.image.resize((size_t)size);
+					input.seekg(0, std::ios::beg);
+					input.read(item.image.data(), (std::streamsize)size);
+				}
+				catch (...) {
+					input.setstate(std::ios::failbit);
+				}
+				if (!input) {
+					release(state, size);
+					state.failed += 1;
+					continue;
+				}
+				count(state.read, size, start);
+				state.readQueue.push(std::move(item));
+			}
+		}
+
+		void processStage(Run &state) {
+			ReadItem item;
+			while (state.readQueue.pop(item)) {
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				uint64_t size = item.image.size();
+				WriteItem result;
+				result.job = item.job;
+				result.size = size;
+				bool keep;
+				try {
+					result.relFile.reset(new RELFile(state.jobs[item.job].inputPath, std::move(item.image)));
+					keep = state.processFunction(*result.relFile);
+				}
+				catch (...) {
+					result.relFile.reset();
+					release(state, size);
+					state.failed += 1;
+					continue;
+				}
+				count(state.process, size, start);
+				if (keep) {
+					// Expanded sections and code caves can grow the image while it waits to be written
+					result.size = (uint64_t)result.relFile->filesize();
+					resize(state, size, result.size);
+					state.writeQueue.push(std::move(result));
+				}
+				else {
+					result.relFile.reset();
+					release(state, size);
+					state.skipped += 1;
+				}
+			}
+		}
+
+		void writeStage(Run &state) {
+			WriteItem item;
+			while (state.writeQueue.pop(item)) {
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				uint64_t written = item.relFile->filesize();
+				bool saved;
+				try {
+					saved = item.relFile->save(state.jobs[item.job].outputPath);
+				}
+				catch (...) {
+					saved = false;
+				}
+				if (saved) {
+					count(state.write, written, start);
+				}
+				else {
+					state.failed += 1;
+				}
+				item.relFile.reset();
+				release(state, item.size);
+			}
+		}
+	};
+}
@@ -0,0 +1,117 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+
+namespace RELPatch {
+
+	/*
+		A big endian value of type <T> stored as raw bytes
+		It has an alignment of 1 so structs of be<> fields can be laid directly over rel file data
+		Works with integer and floating point types of 1, 2, 4 or 8 bytes
+	*/
+	template <typename T>
+	struct be {
+		static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8, "be<T> needs a 1, 2, 4 or 8 byte type");
+
+		unsigned char bytes[sizeof(T)];
+
+		/*
+			Reads the value in host byte order
+		*/
+		T get() const {
+			Bits bits = 0;
+			for (size_t i = 0; i < sizeof(T); i++) {
+				bits = (Bits)((bits << 8) | bytes[i]);
+			}
+			T value;
+			memcpy(&value, &bits, sizeof(T));
+			return value;
+		}
+
+		/*
+			Stores <value> in big endian byte order
+		*/
+		void set(T value) {
+			Bits bits;
+			memcpy(&bits, &value, sizeof(T));
+			for (size_t i = sizeof(T); i > 0; i--) {
+				bytes[i - 1] = (unsigned char)bits;
+				bits = (Bits)(bits >> 4 >> 4);
+			}
+		}
+
+		operator T() const {
+			return get();
+		}
+
+		be& operator=(T value) {
+			set(value);
+			return *this;
+		}
+
+	private:
+		// Unsigned integer with the same size as T, used to shuffle the bytes
+		typedef typename std::conditional<sizeof(T) == 1, uint8_t,
+			typename std::conditional<sizeof(T) == 2, uint16_t,
+			typename std::conditional<sizeof(T) == 4, uint32_t, uint64_t>::type>::type>::type Bits;
+	};
+
+	/*
+		A view of <count> consecutive <T>s that point straight into a buffer (no copies are made)
+		The view doesn't own the data, it becomes invalid when the buffer it points into changes size or is freed
+		<owner> is kept alive as long as the view or a copy of it (such as a lock that keeps the buffer from changing)
+	*/
+	template <typename T>
+	class SectionView {
+	public:
+		typedef T* iterator;
+
+		SectionView() : first(NULL), count(0) {
+		}
+
+		SectionView(T *firstElement, size_t elementCount, std::shared_ptr<const void> owner = nullptr) : first(firstElement), count(elementCount), owner(owner) {
+		}
+
+		T* data() const {
+			return first;
+		}
+
+		size_t size() const {
+			return count;
+		}
+
+		bool empty() const {
+			return count == 0;
+		}
+
+		T& operator[](size_t index) const {
+			return first[index];
+		}
+
+		iterator begin() const {
+			return first;
+		}
+
+		iterator end() const {
+			return first + count;
+		}
+
+		/*
+			A view of <amount> elements starting at element <start> (clamped to the end of this view)
+		*/
+		SectionView subview(size_t start, size_t amount) const {
+			if (start >= count) {
+				return SectionView();
+			}
+			return SectionView(first + start, amount < count - start ? amount : count - start, owner);
+		}
+
+	private:
+		T *first;
+		size_t count;
+		std::shared_ptr<const void> owner;
+	};
+}
@@ -0,0 +1,166 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+namespace RELPatch {
+
+	// Not in the actual specs
+	enum class CodeCaveType {
+		PADDING,							// Alignment padding between the end of a section and the next block of the file
+		ZERO_RUN,							// Run of zero words in an executable section (0 isn't a valid instruction)
+		UNREFERENCED_SYMBOL,				// Function or data from the symbol map that nothing in the module points to
+	};
+
+	// Not in the actual specs
+	typedef struct CodeCave {
+		uint32_t sectionID;					// Section the cave belongs to
+		uint32_t offset;					// Section-relative offset of the cave (padding caves start at or after the end of the section)
+		uint32_t size;						// Size of the cave in bytes
+		uint32_t fileOffset;				// Absolute offset of the cave in the rel file
+		uint8_t executable;					// 1 if the cave is in an executable section
+		CodeCaveType type;					// Where the space comes from
+	}CodeCave;
+
+	// Not in the actual specs
+	typedef struct CodePlacement {
+		uint32_t sectionID;					// Section the space was taken from (0xFFFFFFFF if no cave was large enough)
+		uint32_t offset;					// Section-relative offset of the space
+	}CodePlacement;
+
+	/*
+		Free-list of code caves that space for new code or data is taken from
+		Caves are kept sorted by file offset. An allocation takes the smallest cave that fits (after alignment) and splits the rest back into the list
+	*/
+	class CodeCaveAllocator {
+	public:
+		CodeCaveAllocator() {
+		}
+
+		CodeCaveAllocator(std::vector<CodeCave> const& caves) : freeCaves(caves) {
+			std::sort(freeCaves.begin(), freeCaves.end(), [](CodeCave const& a, CodeCave const& b) {
+				return a.fileOffset < b.fileOffset;
+			});
+		}
+
+		/*
+			Takes <size> bytes aligned to <alignment> (in the file, and so in memory as long as the module is loaded at a larger alignment)
+			Executable requests only use caves in executable sections. Other requests prefer data sections and fall back to executable ones
+			Returns a placement with a section of 0xFFFFFFFF if no cave is large enough
+		*/
+		CodePlacement allocate(uint32_t size, uint32_t alignment, bool executable) {
+			size_t best = findCave(size, alignment, executable, false);
+			if (best == noCave && !executable) {
+				best = findCave(size, alignment, false, true);
+			}
+			CodePlacement placement;
+			placement.sectionID = 0xFFFFFFFF;
+			placement.offset = 0;
+			if (best == noCave) {
+				return placement;
+			}
+
+			CodeCave cave = freeCaves[best];
+			uint32_t start = alignUp(cave.fileOffset, alignment);
+			placement.sectionID = cave.sectionID;
+			placement.offset = cave.offset + (start - cave.fileOffset);
+
+			// Whatever is left in front of and behind the allocation stays free
+			freeCaves.erase(freeCaves.begin() + best);
+			CodeCave after = cave;
+			after.fileOffset = start + size;
+			after.offset = placement.offset + size;
+			after.size = cave.fileOffset + cave.size - after.fileOffset;
+			if (after.size > 0) {
+				freeCaves.insert(freeCaves.begin() + best, after);
+			}
+			CodeCave before = cave;
+			before.size = start - cave.fileOffset;
+			if (before.size > 0) {
+				freeCaves.insert(freeCaves.begin() + best, before);
+			}
+			return placement;
+		}
+
+		/*
+			Removes <size> bytes at <offset> in <sectionID> from the free caves
+		*/
+		void reserve(uint32_t sectionID, uint32_t offset, uint32_t size) {
+			std::vector<CodeCave> remaining;
+			remaining.reserve(freeCaves.size() + 1);
+			for (size_t i = 0; i < freeCaves.size(); i++) {
+				CodeCave const& cave = freeCaves[i];
+				uint64_t caveEnd = (uint64_t)cave.offset + cave.size;
+				uint64_t end = (uint64_t)offset + size;
+				if (cave.sectionID != sectionID || caveEnd <= offset || cave.offset >= end) {
+					remaining.push_back(cave);
+					continue;
+				}
+				if (cave.offset < offset) {
+					CodeCave before = cave;
+					before.size = offset - cave.offset;
+					remaining.push_back(before);
+				}
+				if (caveEnd > end) {
+					CodeCave after = cave;
+					after.offset = (uint32_t)end;
+					after.fileOffset = cave.fileOffset + (after.offset - cave.offset);
+					after.size = (uint32_t)(caveEnd - end);
+					remaining.push_back(after);
+				}
+			}
+			freeCaves.swap(remaining);
+		}
+
+		/*
+			The caves that are still free
+		*/
+		std::vector<CodeCave> const& caves() const {
+			return freeCaves;
+		}
+
+		/*
+			Total number of free bytes
+		*/
+		uint64_t available() const {
+			uint64_t total = 0;
+			for (size_t i = 0; i < freeCaves.size(); i++) {
+				total += freeCaves[i].size;
+			}
+			return total;
+		}
+
+	private:
+		static const size_t noCave = (size_t)-1;
+
+		std::vector<CodeCave> freeCaves;
+
+		static uint32_t alignUp(uint32_t value, uint32_t alignment) {
+			if (alignment <= 1) {
+				return value;
+			}
+			return (value + alignment - 1) / alignment * alignment;
+		}
+
+		/*
+			Index of the smallest cave of the wanted kind that fits <size> bytes aligned to <alignment>
+		*/
+		size_t findCave(uint32_t size, uint32_t alignment, bool executable, bool anyKind) {
+			size_t best = noCave;
+			for (size_t i = 0; i < freeCaves.size(); i++) {
+				CodeCave const& cave = freeCaves[i];
+				if (!anyKind && (cave.executable != 0) != executable) {
+					continue;
+				}
+				uint64_t start = alignUp(cave.fileOffset, alignment);
+				if (start + size > (uint64_t)cave.fileOffset + cave.size) {
+					continue;
+				}
+				if (best == noCave || cave.size < freeCaves[best].size) {
+					best = i;
+				}
+			}
+			return best;
+		}
+	};
+}
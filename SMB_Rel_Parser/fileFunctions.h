@@ -43,4 +43,34 @@ namespace RELPatch {
 	inline void writeBigByte(std::fstream &fileStream, uint8_t value) {
 		fileStream.put((char)value);
 	}
+
+	inline uint32_t readBigInt(const char *buffer) {
+		const unsigned char *bytes = (const unsigned char*)buffer;
+		return (uint32_t)((bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3]);
+	}
+
+	inline uint16_t readBigShort(const char *buffer) {
+		const unsigned char *bytes = (const unsigned char*)buffer;
+		return (uint16_t)((bytes[0] << 8) | bytes[1]);
+	}
+
+	inline uint8_t readBigByte(const char *buffer) {
+		return (uint8_t)buffer[0];
+	}
+
+	inline void writeBigInt(char *buffer, uint32_t value) {
+		buffer[0] = (char)(value >> 24);
+		buffer[1] = (char)(value >> 16);
+		buffer[2] = (char)(value >> 8);
+		buffer[3] = (char)(value);
+	}
+
+	inline void writeBigShort(char *buffer, uint16_t value) {
+		buffer[0] = (char)(value >> 8);
+		buffer[1] = (char)(value);
+	}
+
+	inline void writeBigByte(char *buffer, uint8_t value) {
+		buffer[0] = (char)value;
+	}
 }
\ No newline at end of file
@@ -0,0 +1,119 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "structs.h"
+#include "fileFunctions.h"
+#include "bigEndian.h"
+#include "ppcFields.h"
+
+namespace RELPatch {
+
+	/*
+		Patches the instruction or data at <destination> (located at <destinationAddress>) for a relocation of <relocationType> to <symbolAddress>
+		Follows what OSLink does at runtime. Returns false for types that don't patch anything
+	*/
+	inline bool relocate(char *destination, uint8_t relocationType, uint32_t destinationAddress, uint32_t symbolAddress) {
+		switch (relocationType) {
+		case (uint8_t)RelocationType::R_PPC_ADDR32:
+			writeBigInt(destination, symbolAddress);
+			return true;
+		case (uint8_t)RelocationType::R_PPC_ADDR24:
+			writeBigInt(destination, Field24::insert(readBigInt(destination), symbolAddress));
+			return true;
+		case (uint8_t)RelocationType::R_PPC_ADDR16:
+		case (uint8_t)RelocationType::R_PPC_ADDR16_LO:
+			writeBigShort(destination, (uint16_t)lo(symbolAddress));
+			return true;
+		case (uint8_t)RelocationType::R_PPC_ADDR16_HI:
+			writeBigShort(destination, (uint16_t)hi(symbolAddress));
+			return true;
+		case (uint8_t)RelocationType::R_PPC_ADDR16_HA:
+			writeBigShort(destination, (uint16_t)ha(symbolAddress));
+			return true;
+		case (uint8_t)RelocationType::R_PPC_ADDR14:
+		case (uint8_t)RelocationType::R_PPC_ADDR14_BRTAKEN:
+		case (uint8_t)RelocationType::R_PPC_ADDR14_BRNTAKEN:
+			writeBigInt(destination, Field14::insert(readBigInt(destination), symbolAddress));
+			return true;
+		case (uint8_t)RelocationType::R_PPC_REL24:
+			writeBigInt(destination, Field24::insert(readBigInt(destination), symbolAddress - destinationAddress));
+			return true;
+		case (uint8_t)RelocationType::R_PPC_REL14:
+			writeBigInt(destination, Field14::insert(readBigInt(destination), symbolAddress - destinationAddress));
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	/*
+		A rel module laid out in memory the way the game sees it after OSLink
+		The file is placed at <baseAddress> and the zero-filled BSS follows it in the same buffer
+	*/
+	class LoadedImage {
+	public:
+		uint32_t baseAddress;						// Address of the first byte of <data>
+		uint32_t bssAddress;						// Address of the BSS
+		uint32_t bssSize;							// Size of the BSS
+		std::vector<char> data;						// The module followed by its BSS
+		std::vector<uint32_t> sectionAddresses;		// Address of every section (0 for sections that don't exist)
+		uint32_t appliedRelocations;				// Number of relocations that were applied
+		uint32_t skippedRelocations;				// Number of relocations against other modules (whose addresses aren't known)
+
+		LoadedImage() : baseAddress(0), bssAddress(0), bssSize(0), appliedRelocations(0), skippedRelocations(0) {
+		}
+
+		/*
+			Size of the image in bytes
+		*/
+		uint32_t size() const {
+			return (uint32_t)data.size();
+		}
+
+		/*
+			Checks if <amount> bytes at <address> are inside of the image
+		*/
+		bool contains(uint32_t address, uint32_t amount) const {
+			return address >= baseAddress && (uint64_t)(address - baseAddress) + amount <= data.size();
+		}
+
+		/*
+			Gets a pointer to <address> within the image
+			Returns NULL if <address> is outside of the image
+		*/
+		char* at(uint32_t address) {
+			if (!contains(address, 1)) {
+				return NULL;
+			}
+			return &data[address - baseAddress];
+		}
+
+		/*
+			Gets a view of <count> <T>s at <address> that points straight into the image
+			Returns an empty view if the range isn't inside of the image
+		*/
+		template <typename T>
+		SectionView<T> view(uint32_t address, uint32_t count) {
+			static_assert(std::alignment_of<T>::value == 1, "view needs a type made of be<> fields");
+			if (!contains(address, 0) || (uint64_t)(address - baseAddress) + (uint64_t)count * sizeof(T) > data.size()) {
+				return SectionView<T>();
+			}
+			return SectionView<T>((T*)&data[address - baseAddress], count);
+		}
+
+		/*
+			Writes the image to <filename>
+			Returns false if the file couldn't be written
+		*/
+		bool dump(std::string const& filename) const {
+			std::ofstream output(filename, std::ios::binary | std::ios::trunc);
+			if (!output.is_open()) {
+				return false;
+			}
+			output.write(data.data(), (std::streamsize)data.size());
+			return output.good();
+		}
+	};
+}
@@ -1,11 +1,19 @@
 
 #include "relFile.h"
+#include "relDaemon.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 
 int main(int argc, char *argv[]) {
+#ifndef _WIN32
+	// Keep rel files loaded and answer requests over a Unix domain socket
+	if (argc == 3 && strcmp(argv[1], "--daemon") == 0) {
+		RELPatch::RELDaemon daemon(argv[2]);
+		return daemon.run();
+	}
+#endif
 	/*for (int i = 1; i < argc; i++) {
 		int length = strlen(argv[i]);
 		int validRel = 0;
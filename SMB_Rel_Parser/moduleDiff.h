@@ -0,0 +1,428 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <future>
+#include <unordered_map>
+#include "structs.h"
+#include "fileFunctions.h"
+#include "ppcFields.h"
+
+namespace RELPatch {
+
+	// Not in the actual specs
+	typedef struct ModuleRelocation {
+		uint32_t offset;					// Section-relative offset being patched
+		uint8_t relocationType;				// Type of the relocation
+		uint8_t targetSection;				// Section index of the symbol being patched to
+		uint32_t moduleID;					// Module the symbol is in (0 for the DOL)
+		uint32_t targetOffset;				// Section-relative (module) or absolute (DOL) offset of the symbol
+	}ModuleRelocation;
+
+	// Not in the actual specs
+	typedef struct ModuleSection {
+		uint32_t sectionID;					// Section index in the rel file
+		uint8_t executable;					// 1 if the section is executable
+		std::vector<char> data;				// Contents of the section
+		std::vector<ModuleRelocation> relocations;	// Relocations patching the section, sorted by offset
+		std::vector<uint32_t> symbolStarts;	// Offsets known to start a function or data block (from a symbol map)
+	}ModuleSection;
+
+	// Not in the actual specs
+	typedef struct ModuleContents {
+		uint32_t moduleID;					// ID of the module
+		std::vector<ModuleSection> sections;	// Every section that is stored in the file
+	}ModuleContents;
+
+	// Not in the actual specs
+	enum class BlockMatchType {
+		EXACT,								// Fingerprint is unique in both modules
+		NEIGHBOR,							// Same fingerprint as the block, next to an existing match
+		RELOCATIONS,						// Same relocation pattern (code changed), next to an existing match
+		GAP,								// Same position in an equally long run of unmatched blocks between two matches
+	};
+
+	// Not in the actual specs
+	typedef struct BlockMatch {
+		uint32_t sectionID;					// Section of the block
+		uint32_t oldOffset;					// Section-relative offset of the block in the old module
+		uint32_t oldSize;					// Size of the block in the old module
+		uint32_t newOffset;					// Section-relative offset of the block in the new module
+		uint32_t newSize;					// Size of the block in the new module
+		BlockMatchType type;				// How the blocks were matched
+	}BlockMatch;
+
+	// Not in the actual specs
+	typedef struct SectionAddress {
+		uint32_t sectionID;					// Section index (0xFFFFFFFF if there is no such address)
+		uint32_t offset;					// Section-relative offset
+	}SectionAddress;
+
+	/*
+		Offset translation map from one version of a module to another
+		Both modules are split into blocks (functions ending in blr or starting at a symbol or a relocation target, data starting at a symbol or a relocation target)
+		Every block gets a fingerprint of its instructions with relocated fields and branch displacements masked out plus the types and targets of its relocations
+		Blocks are matched with hash tables, so the cost grows linearly with the size of the modules. Sections are matched in parallel
+	*/
+	class ModuleDiff {
+	public:
+		std::vector<BlockMatch> matches;	// Matched blocks sorted by section and old offset
+		uint32_t oldBlocks;					// Number of blocks in the old module
+		uint32_t newBlocks;					// Number of blocks in the new module
+
+		ModuleDiff() : oldBlocks(0), newBlocks(0) {
+		}
+
+		/*
+			Matches the blocks of <oldModule> against the blocks of <newModule>
+		*/
+		static ModuleDiff match(ModuleContents const& oldModule, ModuleContents const& newModule) {
+			std::vector<std::future<SectionResult>> sections;
+			for (size_t i = 0; i < oldModule.sections.size(); i++) {
+				for (size_t j = 0; j < newModule.sections.size(); j++) {
+					ModuleSection const& oldSection = oldModule.sections[i];
+					ModuleSection const& newSection = newModule.sections[j];
+					if (oldSection.sectionID == newSection.sectionID && oldSection.executable == newSection.executable) {
+						sections.push_back(std::async(std::launch::async, [&oldModule, &newModule, &oldSection, &newSection]() {
+							return matchSection(oldModule, oldSection, newModule, newSection);
+						}));
+					}
+				}
+			}
+
+			ModuleDiff diff;
+			for (size_t i = 0; i < sections.size(); i++) {
+				SectionResult result = sections[i].get();
+				diff.matches.insert(diff.matches.end(), result.matches.begin(), result.matches.end());
+				diff.oldBlocks += result.oldBlocks;
+				diff.newBlocks += result.newBlocks;
+			}
+			std::sort(diff.matches.begin(), diff.matches.end(), [](BlockMatch const& a, BlockMatch const& b) {
+				return a.sectionID < b.sectionID || (a.sectionID == b.sectionID && a.oldOffset < b.oldOffset);
+			});
+			return diff;
+		}
+
+		/*
+			Finds where <offset> in <sectionID> of the old module ended up in the new module
+			Offsets past the end of a block that shrunk can't be translated
+			Returns a section of 0xFFFFFFFF if the offset isn't in a matched block
+		*/
+		SectionAddress translate(uint32_t sectionID, uint32_t offset) const {
+			SectionAddress address;
+			address.sectionID = 0xFFFFFFFF;
+			address.offset = 0;
+			std::vector<BlockMatch>::const_iterator block = std::upper_bound(matches.begin(), matches.end(), std::make_pair(sectionID, offset),
+				[](std::pair<uint32_t, uint32_t> const& position, BlockMatch const& match) {
+					return position.first < match.sectionID || (position.first == match.sectionID && position.second < match.oldOffset);
+				});
+			if (block == matches.begin()) {
+				return address;
+			}
+			--block;
+			uint32_t delta = offset - block->oldOffset;
+			if (block->sectionID != sectionID || delta >= block->oldSize || delta >= block->newSize) {
+				return address;
+			}
+			address.sectionID = sectionID;
+			address.offset = block->newOffset + delta;
+			return address;
+		}
+
+		/*
+			Moves every patch of <patches> to its place in the new module
+			Patches that can't be translated get a section of 0xFFFFFFFF (which patchInstructions skips)
+			Returns the number of patches that couldn't be translated
+		*/
+		uint32_t translate(std::vector<InstructionPatch> &patches) const {
+			uint32_t failed = 0;
+			for (size_t i = 0; i < patches.size(); i++) {
+				SectionAddress address = translate(patches[i].sectionID, patches[i].offset);
+				patches[i].sectionID = address.sectionID;
+				patches[i].offset = address.offset;
+				if (address.sectionID == 0xFFFFFFFF) {
+					++failed;
+				}
+			}
+			return failed;
+		}
+
+		/*
+			Moves both ends of every hook of <hooks> to their places in the new module (see above)
+		*/
+		uint32_t translate(std::vector<BranchHook> &hooks) const {
+			uint32_t failed = 0;
+			for (size_t i = 0; i < hooks.size(); i++) {
+				SectionAddress source = translate(hooks[i].sectionID, hooks[i].offset);
+				SectionAddress target = translate(hooks[i].targetSectionID, hooks[i].targetOffset);
+				if (source.sectionID == 0xFFFFFFFF || target.sectionID == 0xFFFFFFFF) {
+					source.sectionID = 0xFFFFFFFF;
+					target.sectionID = 0xFFFFFFFF;
+					++failed;
+				}
+				hooks[i].sectionID = source.sectionID;
+				hooks[i].offset = source.offset;
+				hooks[i].targetSectionID = target.sectionID;
+				hooks[i].targetOffset = target.offset;
+			}
+			return failed;
+		}
+
+	private:
+		static const uint32_t unmatched = 0xFFFFFFFF;
+
+		typedef struct Block {
+			uint32_t offset;				// Section-relative offset of the block
+			uint32_t size;					// Size of the block
+			uint64_t contentHash;			// Masked contents, relocations and size
+			uint64_t shapeHash;				// Types and targets of the relocations only (0 if there are none)
+			uint32_t match;					// Index of the matching block in the other module
+		}Block;
+
+		typedef struct SectionResult {
+			std::vector<BlockMatch> matches;
+			uint32_t oldBlocks;
+			uint32_t newBlocks;
+		}SectionResult;
+
+		static SectionResult matchSection(ModuleContents const& oldModule, ModuleSection const& oldSection, ModuleContents const& newModule, ModuleSection const& newSection) {
+			std::vector<Block> oldBlocks = splitBlocks(oldModule, oldSection);
+			std::vector<Block> newBlocks = splitBlocks(newModule, newSection);
+
+			// Anchor the blocks whose contents are unique in both modules
+			std::unordered_map<uint64_t, uint32_t> oldUnique = uniqueHashes(oldBlocks);
+			std::unordered_map<uint64_t, uint32_t> newUnique = uniqueHashes(newBlocks);
+			std::vector<BlockMatchType> types(oldBlocks.size(), BlockMatchType::EXACT);
+			for (std::unordered_map<uint64_t, uint32_t>::const_iterator i = oldUnique.begin(); i != oldUnique.end(); ++i) {
+				std::unordered_map<uint64_t, uint32_t>::const_iterator j = newUnique.find(i->first);
+				if (i->second != unmatched && j != newUnique.end() && j->second != unmatched) {
+					pair(oldBlocks, newBlocks, i->second, j->second);
+				}
+			}
+
+			// Grow the matches into unmatched neighbors that look alike
+			for (uint32_t i = 0; i < oldBlocks.size(); i++) {
+				if (oldBlocks[i].match != unmatched) {
+					extend(oldBlocks, newBlocks, types, i, 1);
+				}
+			}
+			for (uint32_t i = (uint32_t)oldBlocks.size(); i-- > 0;) {
+				if (oldBlocks[i].match != unmatched) {
+					extend(oldBlocks, newBlocks, types, i, -1);
+				}
+			}
+
+			// Pair up equally long runs of unmatched blocks between two matches
+			uint32_t previous = unmatched;
+			for (uint32_t i = 0; i < oldBlocks.size(); i++) {
+				if (oldBlocks[i].match == unmatched) {
+					continue;
+				}
+				if (previous != unmatched && i - previous > 1 && oldBlocks[i].match > oldBlocks[previous].match
+					&& oldBlocks[i].match - oldBlocks[previous].match == i - previous) {
+					uint32_t first = oldBlocks[previous].match + 1;
+					bool free = true;
+					for (uint32_t k = 0; k < i - previous - 1; k++) {
+						free = free && newBlocks[first + k].match == unmatched;
+					}
+					for (uint32_t k = 0; free && k < i - previous - 1; k++) {
+						pair(oldBlocks, newBlocks, previous + 1 + k, first + k);
+						types[previous + 1 + k] = BlockMatchType::GAP;
+					}
+				}
+				previous = i;
+			}
+
+			SectionResult result;
+			result.oldBlocks = (uint32_t)oldBlocks.size();
+			result.newBlocks = (uint32_t)newBlocks.size();
+			for (uint32_t i = 0; i < oldBlocks.size(); i++) {
+				if (oldBlocks[i].match == unmatched) {
+					continue;
+				}
+				BlockMatch match;
+				match.sectionID = oldSection.sectionID;
+				match.oldOffset = oldBlocks[i].offset;
+				match.oldSize = oldBlocks[i].size;
+				match.newOffset = newBlocks[oldBlocks[i].match].offset;
+				match.newSize = newBlocks[oldBlocks[i].match].size;
+				match.type = types[i];
+				result.matches.push_back(match);
+			}
+			return result;
+		}
+
+		static void pair(std::vector<Block> &oldBlocks, std::vector<Block> &newBlocks, uint32_t oldIndex, uint32_t newIndex) {
+			oldBlocks[oldIndex].match = newIndex;
+			newBlocks[newIndex].match = oldIndex;
+		}
+
+		/*
+			Matches the blocks following (<step> 1) or preceding (<step> -1) the matched block <index> while they look alike
+		*/
+		static void extend(std::vector<Block> &oldBlocks, std::vector<Block> &newBlocks, std::vector<BlockMatchType> &types, uint32_t index, int step) {
+			int64_t i = (int64_t)index + step;
+			int64_t j = (int64_t)oldBlocks[index].match + step;
+			while (i >= 0 && j >= 0 && i < (int64_t)oldBlocks.size() && j < (int64_t)newBlocks.size()
+				&& oldBlocks[(size_t)i].match == unmatched && newBlocks[(size_t)j].match == unmatched) {
+				Block const& oldBlock = oldBlocks[(size_t)i];
+				Block const& newBlock = newBlocks[(size_t)j];
+				if (oldBlock.contentHash == newBlock.contentHash) {
+					types[(size_t)i] = BlockMatchType::NEIGHBOR;
+				}
+				else if (oldBlock.shapeHash != 0 && oldBlock.shapeHash == newBlock.shapeHash) {
+					types[(size_t)i] = BlockMatchType::RELOCATIONS;
+				}
+				else {
+					break;
+				}
+				pair(oldBlocks, newBlocks, (uint32_t)i, (uint32_t)j);
+				i += step;
+				j += step;
+			}
+		}
+
+		/*
+			Maps every content hash to the block it belongs to, or to unmatched if several blocks share it
+		*/
+		static std::unordered_map<uint64_t, uint32_t> uniqueHashes(std::vector<Block> const& blocks) {
+			std::unordered_map<uint64_t, uint32_t> unique;
+			unique.reserve(blocks.size() * 2);
+			for (uint32_t i = 0; i < blocks.size(); i++) {
+				std::pair<std::unordered_map<uint64_t, uint32_t>::iterator, bool> inserted = unique.insert(std::make_pair(blocks[i].contentHash, i));
+				if (!inserted.second) {
+					inserted.first->second = unmatched;
+				}
+			}
+			return unique;
+		}
+
+		/*
+			Splits <section> of <module> into blocks and fingerprints them
+		*/
+		static std::vector<Block> splitBlocks(ModuleContents const& module, ModuleSection const& section) {
+			uint32_t moduleID = module.moduleID;
+			uint32_t size = (uint32_t)section.data.size();
+			std::vector<char> masked(section.data);
+			std::vector<uint32_t> starts(section.symbolStarts);
+			starts.push_back(0);
+
+			// Every offset the module points to starts a block
+			for (size_t i = 0; i < module.sections.size(); i++) {
+				std::vector<ModuleRelocation> const& relocations = module.sections[i].relocations;
+				for (size_t j = 0; j < relocations.size(); j++) {
+					if (relocations[j].moduleID == moduleID && relocations[j].targetSection == section.sectionID) {
+						starts.push_back(relocations[j].targetOffset);
+					}
+				}
+			}
+
+			// Relocated fields change with the layout, so they are left out of the fingerprint
+			for (size_t i = 0; i < section.relocations.size(); i++) {
+				maskRelocation(masked, section.relocations[i]);
+			}
+			if (section.executable) {
+				for (uint32_t offset = 0; offset + 4 <= size; offset += 4) {
+					uint32_t instruction = readBigInt(&masked[offset]);
+					uint32_t opcode = instruction >> 26;
+					if (opcode == 18) {
+						writeBigInt(&masked[offset], instruction & ~Field24::mask);
+					}
+					else if (opcode == 16) {
+						writeBigInt(&masked[offset], instruction & ~Field14::mask);
+					}
+					else if (instruction == 0x4E800020) {
+						// blr ends a function
+						starts.push_back(offset + 4);
+					}
+				}
+			}
+
+			std::sort(starts.begin(), starts.end());
+			starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+			while (!starts.empty() && starts.back() >= size) {
+				starts.pop_back();
+			}
+
+			std::vector<Block> blocks(starts.size());
+			size_t relocation = 0;
+			for (size_t i = 0; i < starts.size(); i++) {
+				Block &block = blocks[i];
+				block.offset = starts[i];
+				block.size = (i + 1 < starts.size() ? starts[i + 1] : size) - starts[i];
+				block.match = unmatched;
+
+				uint64_t content = hashWord(offsetBasis, block.size);
+				for (uint32_t offset = block.offset; offset < block.offset + block.size; offset++) {
+					content = (content ^ (unsigned char)masked[offset]) * prime;
+				}
+				uint64_t shape = offsetBasis;
+				uint32_t relocations = 0;
+				for (; relocation < section.relocations.size() && section.relocations[relocation].offset < block.offset + block.size; relocation++) {
+					ModuleRelocation const& entry = section.relocations[relocation];
+					if (entry.offset < block.offset) {
+						continue;
+					}
+					uint32_t kind = ((uint32_t)entry.relocationType << 24) | ((uint32_t)entry.targetSection << 16) | (entry.moduleID == moduleID ? 0xFFFF : (entry.moduleID & 0xFFFF));
+					shape = hashWord(shape, kind);
+					content = hashWord(hashWord(content, kind), entry.offset - block.offset);
+					++relocations;
+				}
+				block.contentHash = content;
+				block.shapeHash = relocations == 0 ? 0 : hashWord(shape, relocations);
+			}
+			return blocks;
+		}
+
+		/*
+			Clears the bits of <data> that <relocation> writes to
+		*/
+		static void maskRelocation(std::vector<char> &data, ModuleRelocation const& relocation) {
+			uint32_t offset = relocation.offset;
+			switch (relocation.relocationType) {
+			case (uint8_t)RelocationType::R_PPC_ADDR32:
+				if ((uint64_t)offset + 4 <= data.size()) {
+					writeBigInt(&data[offset], 0);
+				}
+				break;
+			case (uint8_t)RelocationType::R_PPC_ADDR16:
+			case (uint8_t)RelocationType::R_PPC_ADDR16_LO:
+			case (uint8_t)RelocationType::R_PPC_ADDR16_HI:
+			case (uint8_t)RelocationType::R_PPC_ADDR16_HA:
+				if ((uint64_t)offset + 2 <= data.size()) {
+					writeBigShort(&data[offset], 0);
+				}
+				break;
+			case (uint8_t)RelocationType::R_PPC_ADDR24:
+			case (uint8_t)RelocationType::R_PPC_REL24:
+				if ((uint64_t)offset + 4 <= data.size()) {
+					writeBigInt(&data[offset], readBigInt(&data[offset]) & ~Field24::mask);
+				}
+				break;
+			case (uint8_t)RelocationType::R_PPC_ADDR14:
+			case (uint8_t)RelocationType::R_PPC_ADDR14_BRTAKEN:
+			case (uint8_t)RelocationType::R_PPC_ADDR14_BRNTAKEN:
+			case (uint8_t)RelocationType::R_PPC_REL14:
+				if ((uint64_t)offset + 4 <= data.size()) {
+					writeBigInt(&data[offset], readBigInt(&data[offset]) & ~Field14::mask);
+				}
+				break;
+			default:
+				break;
+			}
+		}
+
+		static const uint64_t offsetBasis = 0xCBF29CE484222325ULL;
+		static const uint64_t prime = 0x100000001B3ULL;
+
+		/*
+			Mixes the 4 bytes of <word> into the FNV-1a hash <value>
+		*/
+		static uint64_t hashWord(uint64_t value, uint32_t word) {
+			for (int shift = 24; shift >= 0; shift -= 8) {
+				value = (value ^ ((word >> shift) & 0xFF)) * prime;
+			}
+			return value;
+		}
+	};
+}
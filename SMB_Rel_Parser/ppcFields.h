@@ -0,0 +1,99 @@
+#pragma once
+#include <cstdint>
+
+namespace RELPatch {
+
+	/*
+		A field of a 32-bit PowerPC instruction described by the <Mask> of the bits it covers
+		Bits outside of the mask (opcode, registers, AA/LK bits, ...) are kept when a value is inserted
+	*/
+	template <uint32_t Mask>
+	struct InstructionField {
+		static const uint32_t mask = Mask;
+
+		/*
+			Replaces the field's bits in <instruction> with the matching bits of <value>
+		*/
+		static uint32_t insert(uint32_t instruction, uint32_t value) {
+			return (instruction & ~Mask) | (value & Mask);
+		}
+
+		/*
+			Gets the field's bits of <instruction>
+		*/
+		static uint32_t extract(uint32_t instruction) {
+			return instruction & Mask;
+		}
+	};
+
+	typedef InstructionField<0xFFFFFFFF> WordField;		// The whole instruction
+	typedef InstructionField<0x03FFFFFC> Field24;		// LI field of b/bl (word aligned 26-bit displacement, AA/LK kept)
+	typedef InstructionField<0x0000FFFC> Field14;		// BD field of bc (word aligned 16-bit displacement, AA/LK kept)
+	typedef InstructionField<0x0000FFFF> Field16;		// SIMM/UIMM field of addis/addi/ori/lwz/...
+
+	/*
+		Low 16 bits of <address> (for ori or the second half of an addis/addi pair)
+	*/
+	inline uint32_t lo(uint32_t address) {
+		return address & 0xFFFF;
+	}
+
+	/*
+		High 16 bits of <address> (for addis followed by ori)
+	*/
+	inline uint32_t hi(uint32_t address) {
+		return address >> 16;
+	}
+
+	/*
+		High 16 bits of <address> adjusted for the sign extension of the low half (for addis followed by addi/lwz/stw/...)
+	*/
+	inline uint32_t ha(uint32_t address) {
+		return ((address >> 16) + ((address & 0x8000) ? 1 : 0)) & 0xFFFF;
+	}
+
+	/*
+		Checks if a b/bl at <from> can reach <to>
+	*/
+	inline bool branchInRange(uint32_t from, uint32_t to) {
+		int64_t displacement = (int64_t)to - (int64_t)from;
+		return (displacement & 3) == 0 && displacement >= -0x2000000 && displacement < 0x2000000;
+	}
+
+	/*
+		Encodes a b (or bl if <link> is set) at <from> that jumps to <to>
+	*/
+	inline uint32_t branchInstruction(uint32_t from, uint32_t to, bool link) {
+		return Field24::insert(0x48000000, to - from) | (link ? 1 : 0);
+	}
+
+	// Not in the actual specs
+	typedef struct InstructionPatch {
+		uint32_t sectionID;					// Section of the instruction
+		uint32_t offset;					// Section-relative offset of the instruction (4-byte aligned)
+		uint32_t mask;						// Bits of the instruction that are replaced
+		uint32_t value;						// New value of the replaced bits
+	}InstructionPatch;
+
+	// Not in the actual specs
+	typedef struct BranchHook {
+		uint32_t sectionID;					// Section of the instruction replaced by the branch
+		uint32_t offset;					// Section-relative offset of the instruction replaced by the branch
+		uint32_t targetSectionID;			// Section the branch jumps to
+		uint32_t targetOffset;				// Section-relative offset the branch jumps to
+		bool link;							// Set for bl (call and return), clear for b
+	}BranchHook;
+
+	/*
+		Describes writing <value> into the <Field> of the instruction at <offset> in <sectionID>
+	*/
+	template <typename Field>
+	InstructionPatch fieldPatch(uint32_t sectionID, uint32_t offset, uint32_t value) {
+		InstructionPatch patch;
+		patch.sectionID = sectionID;
+		patch.offset = offset;
+		patch.mask = Field::mask;
+		patch.value = Field::insert(0, value);
+		return patch;
+	}
+}
@@ -0,0 +1,383 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+
+namespace RELPatch {
+
+	// Not in the actual specs
+	typedef struct ModuleAddress {
+		uint32_t moduleID;					// Module the address is in (0 for the DOL)
+		uint32_t sectionID;					// Section in the module (0 for DOL addresses)
+		uint32_t offset;					// Section-relative offset (absolute address for the DOL)
+	}ModuleAddress;
+
+	// Not in the actual specs
+	typedef struct ModuleReference {
+		ModuleAddress site;					// Address patched by the relocation
+		ModuleAddress target;				// Address the relocation points to
+		uint8_t relocationType;				// Type of the relocation
+	}ModuleReference;
+
+	// Not in the actual specs
+	typedef struct ModuleLink {
+		uint32_t moduleID;					// Module holding the references
+		uint32_t importedModuleID;			// Module they point into
+	}ModuleLink;
+
+	/*
+		Every reference between the modules of a game (and from them into the DOL) in compressed sparse row form
+		References are grouped by target, so everything pointing into a range of a section is one contiguous run found by binary search
+		A second order of the references sorted by site answers what a module or an address points to
+		Module IDs are expected to be unique among the modules the graph is built from
+	*/
+	class ReferenceGraph {
+	public:
+		static const uint32_t version = 1;
+
+		ReferenceGraph() : targetStarts(1, 0) {
+		}
+
+		/*
+			Builds the graph from the references of every module in <moduleIDs> (<moduleReferences> has one list per module)
+			Modules with an ID of 0xFFFFFFFF (ones that couldn't be loaded) are left out
+		*/
+		ReferenceGraph(std::vector<uint32_t> const& moduleIDs, std::vector<std::vector<ModuleReference>> const& moduleReferences) {
+			size_t total = 0;
+			for (size_t i = 0; i < moduleIDs.size(); i++) {
+				if (moduleIDs[i] != 0xFFFFFFFF) {
+					loadedModules.push_back(moduleIDs[i]);
+					total += moduleReferences[i].size();
+				}
+			}
+			std::sort(loadedModules.begin(), loadedModules.end());
+			loadedModules.erase(std::unique(loadedModules.begin(), loadedModules.end()), loadedModules.end());
+
+			std::vector<ModuleReference> references;
+			references.reserve(total);
+			for (size_t i = 0; i < moduleIDs.size(); i++) {
+				if (moduleIDs[i] != 0xFFFFFFFF) {
+					references.insert(references.end(), moduleReferences[i].begin(), moduleReferences[i].end());
+				}
+			}
+			std::sort(references.begin(), references.end(), [](ModuleReference const& a, ModuleReference const& b) {
+				if (!same(a.target, b.target)) {
+					return less(a.target, b.target);
+				}
+				return less(a.site, b.site);
+			});
+
+			// One row per distinct target holding the sites that point to it
+			sites.resize(references.size());
+			types.resize(references.size());
+			edgeTargets.resize(references.size());
+			for (size_t i = 0; i < references.size(); i++) {
+				if (i == 0 || !same(references[i].target, references[i - 1].target)) {
+					targets.push_back(references[i].target);
+					targetStarts.push_back((uint32_t)i);
+				}
+				sites[i] = references[i].site;
+				types[i] = references[i].relocationType;
+				edgeTargets[i] = (uint32_t)targets.size() - 1;
+			}
+			targetStarts.push_back((uint32_t)references.size());
+
+			siteOrder.resize(references.size());
+			std::iota(siteOrder.begin(), siteOrder.end(), 0u);
+			std::sort(siteOrder.begin(), siteOrder.end(), [this](uint32_t a, uint32_t b) {
+				return less(sites[a], sites[b]);
+			});
+
+			for (size_t i = 0; i < references.size(); i++) {
+				ModuleLink link;
+				link.moduleID = references[i].site.moduleID;
+				link.importedModuleID = references[i].target.moduleID;
+				links.push_back(link);
+			}
+			std::sort(links.begin(), links.end(), [](ModuleLink const& a, ModuleLink const& b) {
+				return a.moduleID != b.moduleID ? a.moduleID < b.moduleID : a.importedModuleID < b.importedModuleID;
+			});
+			links.erase(std::unique(links.begin(), links.end(), [](ModuleLink const& a, ModuleLink const& b) {
+				return a.moduleID == b.moduleID && a.importedModuleID == b.importedModuleID;
+			}), links.end());
+			reverseLinks = links;
+			std::sort(reverseLinks.begin(), reverseLinks.end(), [](ModuleLink const& a, ModuleLink const& b) {
+				return a.importedModuleID != b.importedModuleID ? a.importedModuleID < b.importedModuleID : a.moduleID < b.moduleID;
+			});
+		}
+
+		/*
+			Finds every reference pointing into the <size> bytes at <target> (in the same module and section)
+			Results are sorted by target and then by site
+		*/
+		std::vector<ModuleReference> referencesTo(ModuleAddress const& target, uint32_t size = 1) const {
+			std::vector<ModuleReference> results;
+			size_t first = std::lower_bound(targets.begin(), targets.end(), target, less) - targets.begin();
+			size_t last = first;
+			uint64_t end = (uint64_t)target.offset + size;
+			while (last < targets.size() && targets[last].moduleID == target.moduleID && targets[last].sectionID == target.sectionID && targets[last].offset < end) {
+				last++;
+			}
+			if (first == last) {
+				return results;
+			}
+			results.reserve(targetStarts[last] - targetStarts[first]);
+			for (uint32_t i = targetStarts[first]; i < targetStarts[last]; i++) {
+				results.push_back(reference(i));
+			}
+			return results;
+		}
+
+		/*
+			Finds every reference from any module pointing into the <size> bytes at <address> in the DOL
+		*/
+		std::vector<ModuleReference> referencesToDol(uint32_t address, uint32_t size = 1) const {
+			ModuleAddress target;
+			target.moduleID = 0;
+			target.sectionID = 0;
+			target.offset = address;
+			return referencesTo(target, size);
+		}
+
+		/*
+			Finds every reference held by <moduleID>, sorted by site
+		*/
+		std::vector<ModuleReference> referencesFrom(uint32_t moduleID) const {
+			std::vector<ModuleReference> results;
+			std::vector<uint32_t>::const_iterator first = std::lower_bound(siteOrder.begin(), siteOrder.end(), moduleID, [this](uint32_t edge, uint32_t value) {
+				return sites[edge].moduleID < value;
+			});
+			for (std::vector<uint32_t>::const_iterator i = first; i != siteOrder.end() && sites[*i].moduleID == moduleID; ++i) {
+				results.push_back(reference(*i));
+			}
+			return results;
+		}
+
+		/*
+			Finds the reference patching <site>
+			Returns false if no relocation patches it
+		*/
+		bool referenceAt(ModuleAddress const& site, ModuleReference &result) const {
+			std::vector<uint32_t>::const_iterator found = std::lower_bound(siteOrder.begin(), siteOrder.end(), site, [this](uint32_t edge, ModuleAddress const& value) {
+				return less(sites[edge], value);
+			});
+			if (found == siteOrder.end() || !same(sites[*found], site)) {
+				return false;
+			}
+			result = reference(*found);
+			return true;
+		}
+
+		/*
+			Modules that hold at least one reference into <moduleID> (0 for the DOL)
+		*/
+		std::vector<uint32_t> importers(uint32_t moduleID) const {
+			std::vector<uint32_t> results;
+			std::vector<ModuleLink>::const_iterator first = std::lower_bound(reverseLinks.begin(), reverseLinks.end(), moduleID, [](ModuleLink const& link, uint32_t value) {
+				return link.importedModuleID < value;
+			});
+			for (std::vector<ModuleLink>::const_iterator i = first; i != reverseLinks.end() && i->importedModuleID == moduleID; ++i) {
+				results.push_back(i->moduleID);
+			}
+			return results;
+		}
+
+		/*
+			Modules (and the DOL as 0) that <moduleID> holds references into
+		*/
+		std::vector<uint32_t> importedModules(uint32_t moduleID) const {
+			std::vector<uint32_t> results;
+			std::vector<ModuleLink>::const_iterator first = std::lower_bound(links.begin(), links.end(), moduleID, [](ModuleLink const& link, uint32_t value) {
+				return link.moduleID < value;
+			});
+			for (std::vector<ModuleLink>::const_iterator i = first; i != links.end() && i->moduleID == moduleID; ++i) {
+				results.push_back(i->importedModuleID);
+			}
+			return results;
+		}
+
+		/*
+			IDs of the modules the graph was built from, sorted
+		*/
+		std::vector<uint32_t> const& modules() const {
+			return loadedModules;
+		}
+
+		size_t referenceCount() const {
+			return sites.size();
+		}
+
+		size_t targetCount() const {
+			return targets.size();
+		}
+
+		/*
+			Writes the graph to <path>
+			Every array is stored in host byte order right after a fixed size header, so the file is read back with a single read
+			Returns false if the file couldn't be written
+		*/
+		bool save(std::string const& path) const {
+			FileHeader fileHeader;
+			memset(&fileHeader, 0, sizeof(fileHeader));
+			memcpy(fileHeader.magic, "RELGRAPH", 8);
+			fileHeader.version = version;
+			fileHeader.byteOrder = byteOrderMark;
+			fileHeader.moduleCount = (uint32_t)loadedModules.size();
+			fileHeader.linkCount = (uint32_t)links.size();
+			fileHeader.targetCount = (uint32_t)targets.size();
+			fileHeader.referenceCount = (uint32_t)sites.size();
+
+			std::ofstream graphFile(path, std::ios::binary | std::ios::trunc);
+			if (!graphFile.is_open()) {
+				return false;
+			}
+			graphFile.write((const char*)&fileHeader, sizeof(fileHeader));
+			writeArray(graphFile, loadedModules);
+			writeArray(graphFile, links);
+			writeArray(graphFile, reverseLinks);
+			writeArray(graphFile, targets);
+			writeArray(graphFile, targetStarts);
+			writeArray(graphFile, sites);
+			writeArray(graphFile, edgeTargets);
+			writeArray(graphFile, siteOrder);
+			writeArray(graphFile, types);
+			return graphFile.good();
+		}
+
+		/*
+			Reads a graph written by save from <path>
+			Returns false (leaving the graph untouched) if the file is missing, from another version or damaged
+		*/
+		bool load(std::string const& path) {
+			std::ifstream graphFile(path, std::ios::binary | std::ios::ate);
+			if (!graphFile.is_open()) {
+				return false;
+			}
+			std::streamoff size = graphFile.tellg();
+			if (size < (std::streamoff)sizeof(FileHeader)) {
+				return false;
+			}
+			std::vector<char> buffer((size_t)size);
+			graphFile.seekg(0, std::ios::beg);
+			graphFile.read(buffer.data(), (std::streamsize)size);
+			if (!graphFile) {
+				return false;
+			}
+
+			FileHeader fileHeader;
+			memcpy(&fileHeader, buffer.data(), sizeof(fileHeader));
+			if (memcmp(fileHeader.magic, "RELGRAPH", 8) != 0 || fileHeader.version != version || fileHeader.byteOrder != byteOrderMark) {
+				return false;
+			}
+			uint64_t references = fileHeader.referenceCount;
+			uint64_t expected = sizeof(FileHeader) + (uint64_t)fileHeader.moduleCount * sizeof(uint32_t) + (uint64_t)fileHeader.linkCount * 2 * sizeof(ModuleLink)
+				+ (uint64_t)fileHeader.targetCount * sizeof(ModuleAddress) + ((uint64_t)fileHeader.targetCount + 1) * sizeof(uint32_t)
+				+ references * (sizeof(ModuleAddress) + 2 * sizeof(uint32_t) + sizeof(uint8_t));
+			if ((uint64_t)buffer.size() != expected) {
+				return false;
+			}
+
+			ReferenceGraph graph;
+			const char *position = buffer.data() + sizeof(FileHeader);
+			readArray(position, graph.loadedModules, fileHeader.moduleCount);
+			readArray(position, graph.links, fileHeader.linkCount);
+			readArray(position, graph.reverseLinks, fileHeader.linkCount);
+			readArray(position, graph.targets, fileHeader.targetCount);
+			readArray(position, graph.targetStarts, (size_t)fileHeader.targetCount + 1);
+			readArray(position, graph.sites, (size_t)references);
+			readArray(position, graph.edgeTargets, (size_t)references);
+			readArray(position, graph.siteOrder, (size_t)references);
+			readArray(position, graph.types, (size_t)references);
+			if (!graph.consistent()) {
+				return false;
+			}
+			*this = std::move(graph);
+			return true;
+		}
+
+	private:
+		static const uint32_t byteOrderMark = 0x01020304;
+
+		typedef struct FileHeader {
+			char magic[8];					// "RELGRAPH"
+			uint32_t version;				// Graph file format version
+			uint32_t byteOrder;				// byteOrderMark written in host byte order
+			uint32_t moduleCount;			// Number of modules the graph was built from
+			uint32_t linkCount;				// Number of module to module links
+			uint32_t targetCount;			// Number of distinct targets
+			uint32_t referenceCount;		// Number of references
+		}FileHeader;
+
+		std::vector<uint32_t> loadedModules;
+		std::vector<ModuleLink> links;				// Module links sorted by the module holding the references
+		std::vector<ModuleLink> reverseLinks;		// Module links sorted by the module being pointed into
+		std::vector<ModuleAddress> targets;			// Distinct targets, sorted
+		std::vector<uint32_t> targetStarts;			// First reference of every target (plus the total at the end)
+		std::vector<ModuleAddress> sites;			// Site of every reference, grouped by target
+		std::vector<uint32_t> edgeTargets;			// Target index of every reference
+		std::vector<uint32_t> siteOrder;			// Reference indices sorted by site
+		std::vector<uint8_t> types;					// Relocation type of every reference
+
+		static bool same(ModuleAddress const& a, ModuleAddress const& b) {
+			return a.moduleID == b.moduleID && a.sectionID == b.sectionID && a.offset == b.offset;
+		}
+
+		static bool less(ModuleAddress const& a, ModuleAddress const& b) {
+			if (a.moduleID != b.moduleID) {
+				return a.moduleID < b.moduleID;
+			}
+			if (a.sectionID != b.sectionID) {
+				return a.sectionID < b.sectionID;
+			}
+			return a.offset < b.offset;
+		}
+
+		ModuleReference reference(uint32_t edge) const {
+			ModuleReference result;
+			result.site = sites[edge];
+			result.target = targets[edgeTargets[edge]];
+			result.relocationType = types[edge];
+			return result;
+		}
+
+		/*
+			Checks that the indices read from a graph file stay within their arrays
+		*/
+		bool consistent() const {
+			if (targetStarts.empty() || targetStarts.front() != 0 || targetStarts.back() != sites.size()) {
+				return false;
+			}
+			for (size_t i = 1; i < targetStarts.size(); i++) {
+				if (targetStarts[i] < targetStarts[i - 1]) {
+					return false;
+				}
+			}
+			for (size_t i = 0; i < sites.size(); i++) {
+				if (edgeTargets[i] >= targets.size() || siteOrder[i] >= sites.size()) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		template <typename T>
+		static void writeArray(std::ofstream &graphFile, std::vector<T> const& values) {
+			if (!values.empty()) {
+				graphFile.write((const char*)values.data(), (std::streamsize)(values.size() * sizeof(T)));
+			}
+		}
+
+		template <typename T>
+		static void readArray(const char *&position, std::vector<T> &values, size_t count) {
+			values.resize(count);
+			if (count > 0) {
+				memcpy(values.data(), position, count * sizeof(T));
+			}
+			position += count * sizeof(T);
+		}
+	};
+}
@@ -0,0 +1,701 @@
+#pragma once
+#ifndef _WIN32
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "relFile.h"
+
+namespace RELPatch {
+
+	/*
+		Long running server that keeps parsed rel files in memory and answers requests over a Unix domain socket
+		Every request is one line holding a flat JSON object and is answered with one line holding a JSON object, for example
+			{"id":1,"op":"sectionOffset","file":"mkb2.main_loop.rel","section":5}
+			{"id":1,"ok":true,"result":1234}
+		Each client is served on its own thread. Rel files are reloaded when their size or modification time changes on disk
+	*/
+	class RELDaemon {
+	private:
+		typedef struct CachedModule {
+			std::shared_ptr<RELFile> relFile;
+			int64_t modifiedTime;
+			int64_t fileSize;
+		}CachedModule;
+
+		// One per rel file. Its lock is held while the module is (re)loaded and while the daemon writes to it,
+		// so the map itself is only locked for lookups and a write is never mistaken for a change on disk
+		typedef struct ModuleSlot {
+			std::mutex lock;
+			CachedModule cached;
+		}ModuleSlot;
+
+		typedef std::map<std::string, std::string> Request;
+
+		std::string socketPath;
+		std::map<std::string, std::shared_ptr<ModuleSlot>> modules;
+		std::mutex modulesLock;
+
+		// Connected clients, so they can be disconnected and waited for when the daemon stops
+		std::set<int> clients;
+		std::mutex clientsLock;
+		std::condition_variable clientsDone;
+
+	public:
+		RELDaemon(std::string const& path) : socketPath(path) {
+		}
+
+		/*
+			Listens on the socket and serves clients until SIGINT or SIGTERM is received
+			Connected clients are disconnected and their threads finished before it returns
+			Returns 0 once stopped by a signal (the socket file is removed) and 1 if the socket or stop pipe couldn't be set up or accepting a connection failed
+		*/
+		int run() {
+			// A client disconnecting while we write to it shouldn't kill the daemon
+			signal(SIGPIPE, SIG_IGN);
+
+			// The signal can be delivered to any thread, so the handler writes to a pipe the accept loop polls alongside the socket
+			int *wakeup = stopPipe();
+			if (wakeup[0] < 0) {
+				std::cout << "Failed to create pipe: " << strerror(errno) << std::endl;
+				return 1;
+			}
+			char drained[64];
+			while (read(wakeup[0], drained, sizeof(drained)) > 0) {
+			}
+			stopRequested().store(false);
+			stopPipeWriter().store(wakeup[1]);
+			struct sigaction stopAction;
+			memset(&stopAction, 0, sizeof(stopAction));
+			stopAction.sa_handler = &RELDaemon::requestStop;
+			sigemptyset(&stopAction.sa_mask);
+			sigaction(SIGINT, &stopAction, NULL);
+			sigaction(SIGTERM, &stopAction, NULL);
+
+			int server = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (server < 0) {
+				std::cout << "Failed to create socket: " << strerror(errno) << std::endl;
+				return 1;
+			}
+			sockaddr_un address;
+			memset(&address, 0, sizeof(address));
+			address.sun_family = AF_UNIX;
+			if (socketPath.size() >= sizeof(address.sun_path)) {
+				std::cout << "Socket path is too long: " << socketPath << std::endl;
+				close(server);
+				return 1;
+			}
+			strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+			unlink(socketPath.c_str());
+
+			if (bind(server, (sockaddr*)&address, sizeof(address)) != 0 || listen(server, 64) != 0) {
+				std::cout << "Failed to listen on " << socketPath << ": " << strerror(errno) << std::endl;
+				close(server);
+				return 1;
+			}
+
+			int status = 0;
+			while (!stopRequested().load()) {
+				pollfd waiting[2];
+				waiting[0].fd = server;
+				waiting[0].events = POLLIN;
+				waiting[0].revents = 0;
+				waiting[1].fd = wakeup[0];
+				waiting[1].events = POLLIN;
+				waiting[1].revents = 0;
+				if (poll(waiting, 2, -1) < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					std::cout << "Failed to wait for a connection: " << strerror(errno) << std::endl;
+					status = 1;
+					break;
+				}
+				if (waiting[1].revents != 0) {
+					break;
+				}
+				if (waiting[0].revents == 0) {
+					continue;
+				}
+				int client = accept(server, NULL, NULL);
+				if (client < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					std::cout << "Failed to accept a connection: " << strerror(errno) << std::endl;
+					status = 1;
+					break;
+				}
+				std::lock_guard<std::mutex> lock(clientsLock);
+				clients.insert(client);
+				std::thread(&RELDaemon::serveClient, this, client).detach();
+			}
+			close(server);
+			unlink(socketPath.c_str());
+
+			// Wake up every client thread blocked in recv and wait until all of them are gone
+			std::unique_lock<std::mutex> lock(clientsLock);
+			for (std::set<int>::iterator i = clients.begin(); i != clients.end(); ++i) {
+				shutdown(*i, SHUT_RDWR);
+			}
+			clientsDone.wait(lock, [this]() { return clients.empty(); });
+			return status;
+		}
+
+		/*
+			Answers a single request <line> and returns the response line (without the trailing newline)
+		*/
+		std::string handle(std::string const& line) {
+			Request request;
+			Request rawValues;
+			std::ostringstream response;
+			response << "{";
+			if (!parseRequest(line, request, rawValues)) {
+				response << "\"ok\":false,\"error\":\"malformed request\"}";
+				return response.str();
+			}
+			// The id is echoed exactly as it was sent so it keeps its JSON type
+			if (rawValues.count("id")) {
+				response << "\"id\":" << rawValues["id"] << ",";
+			}
+
+			std::string error;
+			std::string result = execute(request, error);
+			if (!error.empty()) {
+				response << "\"ok\":false,\"error\":" << jsonString(error) << "}";
+			}
+			else {
+				response << "\"ok\":true,\"result\":" << result << "}";
+			}
+			return response.str();
+		}
+
+	private:
+
+		// Atomic rather than sig_atomic_t because the handler may run on a client thread
+		static std::atomic<bool>& stopRequested() {
+			static std::atomic<bool> requested(false);
+			return requested;
+		}
+
+		/*
+			The non-blocking pipe that wakes up the accept loop ({-1, -1} if it couldn't be created)
+			It is created once and never closed so a late signal can't write to a closed or reused descriptor
+		*/
+		static int* stopPipe() {
+			static int descriptors[2] = { -1, -1 };
+			static std::once_flag created;
+			std::call_once(created, []() {
+				int wakeup[2];
+				if (pipe(wakeup) == 0) {
+					fcntl(wakeup[0], F_SETFL, O_NONBLOCK);
+					fcntl(wakeup[1], F_SETFL, O_NONBLOCK);
+					descriptors[0] = wakeup[0];
+					descriptors[1] = wakeup[1];
+				}
+			});
+			return descriptors;
+		}
+
+		// Write end of the stop pipe for the signal handler, which can't call stopPipe
+		static std::atomic<int>& stopPipeWriter() {
+			static std::atomic<int> descriptor(-1);
+			return descriptor;
+		}
+
+		static void requestStop(int) {
+			int savedErrno = errno;
+			stopRequested().store(true);
+			int descriptor = stopPipeWriter().load();
+			if (descriptor >= 0) {
+				char wake = 1;
+				ssize_t written = write(descriptor, &wake, 1);
+				(void)written;
+			}
+			errno = savedErrno;
+		}
+
+		/*
+			Reads request lines from <client> and writes a response line for each until the client disconnects
+		*/
+		void serveClient(int client) {
+			std::string pending;
+			char buffer[4096];
+			while (true) {
+				ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+				if (received < 0 && errno == EINTR) {
+					continue;
+				}
+				if (received <= 0) {
+					break;
+				}
+				pending.append(buffer, (size_t)received);
+
+				size_t lineEnd;
+				std::string responses;
+				while ((lineEnd = pending.find('\n')) != std::string::npos) {
+					std::string line = pending.substr(0, lineEnd);
+					pending.erase(0, lineEnd + 1);
+					if (!line.empty() && line[line.size() - 1] == '\r') {
+						line.erase(line.size() - 1);
+					}
+					if (!line.empty()) {
+						responses += handle(line);
+						responses += '\n';
+					}
+				}
+				if (!responses.empty() && !sendAll(client, responses)) {
+					break;
+				}
+			}
+			std::lock_guard<std::mutex> lock(clientsLock);
+			clients.erase(client);
+			close(client);
+			clientsDone.notify_all();
+		}
+
+		/*
+			Runs the operation of <request>
+			Returns the JSON result, or sets <error> on failure
+		*/
+		std::string execute(Request &request, std::string &error) {
+			std::string op = request["op"];
+			if (op == "ping") {
+				return "\"pong\"";
+			}
+			if (!request.count("file")) {
+				error = "missing file";
+				return "";
+			}
+			if (op == "unload") {
+				std::lock_guard<std::mutex> lock(modulesLock);
+				return modules.erase(request["file"]) ? "true" : "false";
+			}
+
+			// Writes keep the module's slot locked until the new modification time is recorded
+			bool writes = op == "writeToSection" || op == "writeData";
+			std::shared_ptr<ModuleSlot> slot = moduleSlot(request["file"]);
+			std::unique_lock<std::mutex> moduleLock(slot->lock);
+			std::shared_ptr<RELFile> relFile = module(*slot, request["file"], op == "reload");
+			if (!writes) {
+				moduleLock.unlock();
+			}
+			if (!relFile) {
+				error = "failed to open " + request["file"];
+				return "";
+			}
+
+			uint32_t sectionID = number(request, "section");
+			uint32_t offset = number(request, "offset");
+			std::ostringstream result;
+			if (op == "reload") {
+				result << "true";
+			}
+			else if (op == "filesize") {
+				result << relFile->filesize();
+			}
+			else if (op == "sectionOffset") {
+				result << relFile->sectionOffset(sectionID);
+			}
+			else if (op == "sectionSize") {
+				result << relFile->sectionSize(sectionID);
+			}
+			else if (op == "isSectionExecutable") {
+				result << (uint32_t)relFile->isSectionExecutable(sectionID);
+			}
+			else if (op == "relocationsOffset") {
+				result << relFile->relocationsOffset();
+			}
+			else if (op == "readData") {
+				uint32_t amount = number(request, "amount");
+				if (relFile->sectionSize(sectionID) == 0xFFFFFFFF || (uint64_t)offset + amount > relFile->sectionSize(sectionID)) {
+					error = "read outside of section";
+					return "";
+				}
+				std::vector<char> buffer(amount);
+				relFile->readData(sectionID, offset, buffer.data(), amount);
+				result << "\"" << toHex(buffer) << "\"";
+			}
+			else if (op == "findPointerAddresses") {
+				std::vector<RelocationTable> pointers = relFile->findPointerAddresses(sectionID, offset, number(request, "tolerance"));
+				result << "[";
+				for (size_t i = 0; i < pointers.size(); i++) {
+					result << (i > 0 ? "," : "")
+						<< "{\"absoluteRelocationOffset\":" << pointers[i].absoluteRelocationOffset
+						<< ",\"relocationType\":" << (uint32_t)pointers[i].relocationType
+						<< ",\"moduleID\":" << pointers[i].moduleID
+						<< ",\"sectionIndex\":" << (uint32_t)pointers[i].sectionIndex
+						<< ",\"symbolOffset\":" << pointers[i].symbolOffset
+						<< ",\"destinationSectionIndex\":" << (uint32_t)pointers[i].destinationSectionIndex
+						<< ",\"destinationSectionOffset\":" << pointers[i].destinationSectionOffset << "}";
+				}
+				result << "]";
+			}
+			else if (op == "writeToSection") {
+				uint32_t value = number(request, "value");
+				uint32_t size = request.count("size") ? number(request, "size") : 4;
+				if (size == 4) {
+					relFile->writeToSection(sectionID, offset, value);
+				}
+				else if (size == 2) {
+					relFile->writeToSection(sectionID, offset, (uint16_t)value);
+				}
+				else if (size == 1) {
+					relFile->writeToSection(sectionID, offset, (uint8_t)value);
+				}
+				else {
+					error = "size must be 1, 2 or 4";
+					return "";
+				}
+				result << "true";
+			}
+			else if (op == "writeData") {
+				std::vector<char> buffer;
+				if (!fromHex(request["data"], buffer)) {
+					error = "data must be a hex string";
+					return "";
+				}
+				relFile->writeData(sectionID, offset, buffer.data(), (uint32_t)buffer.size());
+				result << "true";
+			}
+			else {
+				error = "unknown op " + op;
+				return "";
+			}
+
+			if (writes) {
+				remember(*slot, request["file"]);
+			}
+			return result.str();
+		}
+
+		/*
+			Gets the slot of <filename>, adding an empty one if it isn't known yet
+		*/
+		std::shared_ptr<ModuleSlot> moduleSlot(std::string const& filename) {
+			std::lock_guard<std::mutex> lock(modulesLock);
+			std::shared_ptr<ModuleSlot> &slot = modules[filename];
+			if (!slot) {
+				slot = std::make_shared<ModuleSlot>();
+			}
+			return slot;
+		}
+
+		/*
+			Gets the parsed rel file <filename>, opening it again if it isn't loaded yet, changed on disk or <forceReload> is set
+			The lock of <slot> has to be held, other modules can be looked up and loaded meanwhile
+		*/
+		std::shared_ptr<RELFile> module(ModuleSlot &slot, std::string const& filename, bool forceReload) {
+			int64_t modifiedTime;
+			int64_t fileSize;
+			if (!fileStatus(filename, modifiedTime, fileSize)) {
+				return std::shared_ptr<RELFile>();
+			}
+			CachedModule &cached = slot.cached;
+			if (!forceReload && cached.relFile && cached.modifiedTime == modifiedTime && cached.fileSize == fileSize) {
+				return cached.relFile;
+			}
+
+			std::shared_ptr<RELFile> loaded = std::make_shared<RELFile>(filename);
+			if (loaded->filesize() <= 0) {
+				return std::shared_ptr<RELFile>();
+			}
+			cached.relFile = loaded;
+			cached.modifiedTime = modifiedTime;
+			cached.fileSize = fileSize;
+			return loaded;
+		}
+
+		/*
+			Flushes the module of <slot> and records the new size and modification time of <filename> so the daemon's own write isn't taken for a change on disk
+			The lock of <slot> has to be held since the write
+		*/
+		void remember(ModuleSlot &slot, std::string const& filename) {
+			slot.cached.relFile->flush();
+			fileStatus(filename, slot.cached.modifiedTime, slot.cached.fileSize);
+		}
+
+		static bool fileStatus(std::string const& filename, int64_t &modifiedTime, int64_t &fileSize) {
+			struct stat status;
+			if (stat(filename.c_str(), &status) != 0) {
+				return false;
+			}
+			// Whole seconds would miss a change made within the same second that keeps the size
+#ifdef __APPLE__
+			modifiedTime = (int64_t)status.st_mtimespec.tv_sec * 1000000000 + status.st_mtimespec.tv_nsec;
+#else
+			modifiedTime = (int64_t)status.st_mtim.tv_sec * 1000000000 + status.st_mtim.tv_nsec;
+#endif
+			fileSize = (int64_t)status.st_size;
+			return true;
+		}
+
+		static bool sendAll(int client, std::string const& data) {
+			size_t sent = 0;
+			while (sent < data.size()) {
+				ssize_t written = send(client, data.data() + sent, data.size() - sent, 0);
+				if (written < 0 && errno == EINTR) {
+					continue;
+				}
+				if (written <= 0) {
+					return false;
+				}
+				sent += (size_t)written;
+			}
+			return true;
+		}
+
+		/*
+			Reads the number in <field> of <request> (0 if missing)
+		*/
+		static uint32_t number(Request &request, std::string const& field) {
+			Request::iterator value = request.find(field);
+			if (value == request.end()) {
+				return 0;
+			}
+			return (uint32_t)strtoul(value->second.c_str(), NULL, 0);
+		}
+
+		/*
+			Parses a flat JSON object <line> into <request>
+			Values can be strings, numbers, true, false or null and are all stored as strings. <rawValues> gets the JSON text of every value as it was sent
+		*/
+		static bool parseRequest(std::string const& line, Request &request, Request &rawValues) {
+			size_t position = 0;
+			skipWhitespace(line, position);
+			if (position >= line.size() || line[position] != '{') {
+				return false;
+			}
+			++position;
+			skipWhitespace(line, position);
+			if (position < line.size() && line[position] == '}') {
+				return true;
+			}
+			while (position < line.size()) {
+				std::string key;
+				std::string value;
+				skipWhitespace(line, position);
+				if (!parseString(line, position, key)) {
+					return false;
+				}
+				skipWhitespace(line, position);
+				if (position >= line.size() || line[position] != ':') {
+					return false;
+				}
+				++position;
+				skipWhitespace(line, position);
+				size_t start = position;
+				if (position < line.size() && line[position] == '"') {
+					if (!parseString(line, position, value)) {
+						return false;
+					}
+				}
+				else {
+					while (position < line.size() && line[position] != ',' && line[position] != '}' && !isspace((unsigned char)line[position])) {
+						++position;
+					}
+					value = line.substr(start, position - start);
+					if (!isLiteral(value)) {
+						return false;
+					}
+				}
+				request[key] = value;
+				rawValues[key] = line.substr(start, position - start);
+
+				skipWhitespace(line, position);
+				if (position >= line.size()) {
+					return false;
+				}
+				if (line[position] == '}') {
+					return true;
+				}
+				if (line[position] != ',') {
+					return false;
+				}
+				++position;
+			}
+			return false;
+		}
+
+		static void skipWhitespace(std::string const& line, size_t &position) {
+			while (position < line.size() && isspace((unsigned char)line[position])) {
+				++position;
+			}
+		}
+
+		/*
+			Checks if <value> is a JSON number, true, false or null
+		*/
+		static bool isLiteral(std::string const& value) {
+			if (value == "true" || value == "false" || value == "null") {
+				return true;
+			}
+			size_t position = 0;
+			if (position < value.size() && value[position] == '-') {
+				++position;
+			}
+			if (position >= value.size() || !isdigit((unsigned char)value[position])) {
+				return false;
+			}
+			if (value[position] == '0') {
+				++position;
+			}
+			else {
+				position = skipDigits(value, position);
+			}
+			if (position < value.size() && value[position] == '.') {
+				size_t fraction = position + 1;
+				position = skipDigits(value, fraction);
+				if (position == fraction) {
+					return false;
+				}
+			}
+			if (position < value.size() && (value[position] == 'e' || value[position] == 'E')) {
+				++position;
+				if (position < value.size() && (value[position] == '+' || value[position] == '-')) {
+					++position;
+				}
+				size_t exponent = position;
+				position = skipDigits(value, exponent);
+				if (position == exponent) {
+					return false;
+				}
+			}
+			return position == value.size();
+		}
+
+		static size_t skipDigits(std::string const& value, size_t position) {
+			while (position < value.size() && isdigit((unsigned char)value[position])) {
+				++position;
+			}
+			return position;
+		}
+
+		/*
+			Parses the JSON string starting at <position> into <value>
+			Only the common escapes are understood (\uXXXX escapes are kept as-is)
+		*/
+		static bool parseString(std::string const& line, size_t &position, std::string &value) {
+			if (position >= line.size() || line[position] != '"') {
+				return false;
+			}
+			for (++position; position < line.size(); ++position) {
+				char current = line[position];
+				if (current == '"') {
+					++position;
+					return true;
+				}
+				if (current == '\\' && position + 1 < line.size()) {
+					char escaped = line[++position];
+					switch (escaped) {
+					case 'n':
+						value += '\n';
+						break;
+					case 't':
+						value += '\t';
+						break;
+					case 'r':
+						value += '\r';
+						break;
+					case 'u':
+						value += "\\u";
+						break;
+					default:
+						value += escaped;
+						break;
+					}
+				}
+				else {
+					value += current;
+				}
+			}
+			return false;
+		}
+
+		/*
+			Formats <value> as a JSON string
+		*/
+		static std::string jsonString(std::string const& value) {
+			std::string escaped = "\"";
+			for (size_t i = 0; i < value.size(); i++) {
+				char current = value[i];
+				if (current == '"' || current == '\\') {
+					escaped += '\\';
+					escaped += current;
+				}
+				else if (current == '\n') {
+					escaped += "\\n";
+				}
+				else if ((unsigned char)current < 0x20) {
+					char code[8];
+					snprintf(code, sizeof(code), "\\u%04x", (unsigned char)current);
+					escaped += code;
+				}
+				else {
+					escaped += current;
+				}
+			}
+			return escaped + "\"";
+		}
+
+		static std::string toHex(std::vector<char> const& buffer) {
+			static const char digits[] = "0123456789abcdef";
+			std::string hex;
+			hex.reserve(buffer.size() * 2);
+			for (size_t i = 0; i < buffer.size(); i++) {
+				hex += digits[((unsigned char)buffer[i]) >> 4];
+				hex += digits[((unsigned char)buffer[i]) & 0xF];
+			}
+			return hex;
+		}
+
+		static bool fromHex(std::string const& hex, std::vector<char> &buffer) {
+			if (hex.size() % 2 != 0) {
+				return false;
+			}
+			buffer.resize(hex.size() / 2);
+			for (size_t i = 0; i < buffer.size(); i++) {
+				int high = hexDigit(hex[i * 2]);
+				int low = hexDigit(hex[i * 2 + 1]);
+				if (high < 0 || low < 0) {
+					return false;
+				}
+				buffer[i] = (char)((high << 4) | low);
+			}
+			return true;
+		}
+
+		static int hexDigit(char digit) {
+			if (digit >= '0' && digit <= '9') {
+				return digit - '0';
+			}
+			if (digit >= 'a' && digit <= 'f') {
+				return digit - 'a' + 10;
+			}
+			if (digit >= 'A' && digit <= 'F') {
+				return digit - 'A' + 10;
+			}
+			return -1;
+		}
+	};
+}
+#endif
@@ -4,12 +4,34 @@
 #include <memory>
 #include "structs.h"
 #include "fileFunctions.h"
+#include "relocationIndex.h"
+#include "relocationCache.h"
+#include "loadedImage.h"
+#include "bigEndian.h"
+#include "ppcFields.h"
+#include "symbolMap.h"
+#include "codeCaves.h"
+#include "moduleDiff.h"
+#include "relStructure.h"
+#include "referenceGraph.h"
 #include <string>
 #include <vector>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <map>
+#include <shared_mutex>
+#include <thread>
 #include <errno.h>
+#include <string.h>
 
 namespace RELPatch {
 
+	/*
+		A rel file loaded into memory
+		The whole file is kept in an in-memory image and every change is written through to the file on disk
+		Query functions can be called from multiple threads at once, modifying functions are serialized
+	*/
 	class RELFile {
 	public:
 
@@ -18,35 +40,184 @@ namespace RELPatch {
 		std::unique_ptr<SectionInfoTable[]> sectionInfoTable;
 		std::unique_ptr<ImportTable[]> importTable;
 		std::fstream relFile;
+		std::string filename;
+
+		// Everything wrong with the layout of the file (a file with problems is treated as having no sections or imports)
+		std::vector<StructureProblem> structureProblems;
+
+		// False for rel files built from an image that was read ahead of time (changes stay in memory until save)
+		bool writeThrough;
+
+		// In-memory copy of the whole rel file. Reads are served from here so no stream cursor is shared between threads
+		std::vector<char> image;
+
+		// Readers take a shared lock, anything that modifies the file or the parsed tables takes a unique lock
+		std::shared_timed_mutex imageLock;
+
+		typedef std::shared_lock<std::shared_timed_mutex> ReadLock;
+		typedef std::unique_lock<std::shared_timed_mutex> WriteLock;
+
+		// Decoded relocations of every import. Rebuilt on first use after the relocations or import table are written to
+		RelocationIndex relocationIndex;
+		std::atomic<bool> relocationIndexStale;
+		std::mutex relocationIndexBuildLock;
+
+		// Pages of the image saved before their first change after a snapshot (copy-on-write), along with the symbols and code cave allocations
+		typedef struct ImageSnapshot {
+			size_t imageSize;													// Size of the image when the snapshot was taken
+			std::map<size_t, std::shared_ptr<const std::vector<char>>> pages;	// Page number -> contents of the page when the snapshot was taken
+			size_t symbolCount;													// Number of symbols loaded at the snapshot that are still loaded
+			std::vector<SavedSymbol> symbols;									// Symbols of the snapshot that were cleared since, loaded after the first <symbolCount>
+			std::vector<std::pair<CodePlacement, uint32_t>> codeCaveAllocations;	// Space handed out by allocate when the snapshot was taken
+		}ImageSnapshot;
+
+		static const size_t snapshotPageSize = 4096;
+		std::vector<ImageSnapshot> undoSnapshots;
+		std::vector<ImageSnapshot> redoSnapshots;
+
+		// Symbols loaded with loadSymbols for the name based functions
+		SymbolMap symbolMap;
+
+		// Free space handed out by allocate. Rescanned when the layout, the relocations or the symbols change
+		static const uint32_t codeCaveMinimumSize = 8;
+		CodeCaveAllocator codeCaveAllocator;
+		std::vector<std::pair<CodePlacement, uint32_t>> codeCaveAllocations;
+		bool codeCavesStale;
 
 	public:
-		RELFile(char const*filename) {
+		RELFile(char const*filename) : filename(filename), writeThrough(true), relocationIndexStale(true), codeCavesStale(true) {
 			relFile.open(filename, std::ios::binary | std::ios::in | std::ios::out);
 			if (relFile.is_open()) {
+				loadImage();
 				parseRel();
 			}
 		}
 
-		RELFile(std::string const& filename) {
+		RELFile(std::string const& filename) : filename(filename), writeThrough(true), relocationIndexStale(true), codeCavesStale(true) {
 			relFile.open(filename, std::ios::binary | std::ios::in | std::ios::out);
 			if (relFile.is_open()) {
+				loadImage();
 				parseRel();
 			}
 		}
 
+		/*
+			Uses <prefetchedImage> as the contents of the rel file <filename> instead of reading it (for files that were read ahead of time)
+			The file isn't opened, changes stay in memory until they are written with save
+		*/
+		RELFile(std::string const& filename, std::vector<char> &&prefetchedImage) : filename(filename), writeThrough(false), image(std::move(prefetchedImage)), relocationIndexStale(true), codeCavesStale(true) {
+			parseRel();
+		}
+
+		/*
+			Writes the whole rel file to <path>
+			Returns false if the file couldn't be written
+		*/
+		bool save(std::string const& path) {
+			ReadLock lock(imageLock);
+			std::ofstream output(path, std::ios::binary | std::ios::trunc);
+			if (!output.is_open()) {
+				return false;
+			}
+			output.write(image.data(), (std::streamsize)image.size());
+			return output.good();
+		}
+
+		/*
+			Checks if the rel file passed the structural checks when it was opened (see RELStructure::validate)
+		*/
+		bool isValid() {
+			ReadLock lock(imageLock);
+			return header && structureProblems.empty();
+		}
+
+		/*
+			Everything the structural checks found wrong with the rel file
+		*/
+		std::vector<StructureProblem> problems() {
+			ReadLock lock(imageLock);
+			return structureProblems;
+		}
+
+		/*
+			Reads and checks only the header, tables and relocation ranges of <filename> without opening it as a RELFile (for listing many modules)
+			Returns false if the file couldn't be opened
+		*/
+		static bool readMetadata(std::string const& filename, RELMetadata &metadata) {
+			return RELStructure::readMetadata(filename, metadata);
+		}
+
 		/*
 			Retreives the current filesize of the rel file
 		*/
 		std::streamoff filesize() {
-			// Save the current position and go to the beginning of the file
-			std::streamoff savePos = relFile.tellg();
-			relFile.seekg(0, std::fstream::end);
-			
-			std::streamoff filesize = relFile.tellg();
-			// Return the the previous file position
-			relFile.seekg(savePos, std::fstream::beg);
+			ReadLock lock(imageLock);
+			return (std::streamoff)image.size();
+		}
+
+		/*
+			Makes sure every change has reached the rel file on disk
+		*/
+		void flush() {
+			WriteLock lock(imageLock);
+			relFile.flush();
+		}
+
+		/*
+			Takes a snapshot of the rel file, the loaded symbols and the code cave allocations that undo can go back to
+			No data is copied until a page of the file is changed or the symbols are cleared, so snapshots are cheap to take
+			Taking a snapshot clears the redo history
+			Returns the number of snapshots that can be undone
+		*/
+		size_t snapshot() {
+			WriteLock lock(imageLock);
+			ImageSnapshot snapshot;
+			snapshot.imageSize = image.size();
+			snapshot.symbolCount = symbolMap.size();
+			snapshot.codeCaveAllocations = codeCaveAllocations;
+			undoSnapshots.push_back(snapshot);
+			redoSnapshots.clear();
+			return undoSnapshots.size();
+		}
+
+		/*
+			Restores the rel file, the symbols and the code cave allocations to the last snapshot. Only the pages changed since then are touched
+			Pointers to symbols loaded after the snapshot become invalid
+			Returns false if there is no snapshot to go back to
+		*/
+		bool undo() {
+			WriteLock lock(imageLock);
+			if (undoSnapshots.empty()) {
+				return false;
+			}
+			ImageSnapshot snapshot = std::move(undoSnapshots.back());
+			undoSnapshots.pop_back();
+			redoSnapshots.push_back(restoreSnapshot(snapshot));
+			return true;
+		}
+
+		/*
+			Reapplies the changes taken back by the last undo
+			Returns false if there is nothing to redo (any change after an undo clears the redo history)
+		*/
+		bool redo() {
+			WriteLock lock(imageLock);
+			if (redoSnapshots.empty()) {
+				return false;
+			}
+			ImageSnapshot snapshot = std::move(redoSnapshots.back());
+			redoSnapshots.pop_back();
+			undoSnapshots.push_back(restoreSnapshot(snapshot));
+			return true;
+		}
 
-			return filesize;
+		/*
+			Forgets every snapshot and the redo history, freeing the saved pages
+		*/
+		void discardSnapshots() {
+			WriteLock lock(imageLock);
+			undoSnapshots.clear();
+			redoSnapshots.clear();
 		}
 
 		/*
@@ -54,6 +225,7 @@ namespace RELPatch {
 			Return -1 on invalid <sectionID>
 		*/
 		uint32_t sectionSize(uint32_t sectionID) {
+			ReadLock lock(imageLock);
 			if (validSection(sectionID)) {
 				return sectionInfoTable[sectionID].size;
 			}
@@ -65,6 +237,7 @@ namespace RELPatch {
 			Return -1 on invalid <sectionID>
 		*/
 		uint32_t sectionSizeRounded(uint32_t sectionID) {
+			ReadLock lock(imageLock);
 			if (validSection(sectionID)) {
 				uint32_t size = sectionInfoTable[sectionID].size;
 				if (size % 4 != 0) {
@@ -80,6 +253,7 @@ namespace RELPatch {
 			Return -1 on invalid <sectionID>
 		*/
 		uint32_t sectionOffset(uint32_t sectionID) {
+			ReadLock lock(imageLock);
 			if (validSection(sectionID)) {
 				return toAddress(sectionInfoTable[sectionID].offset);
 			}
@@ -92,19 +266,17 @@ namespace RELPatch {
 			Returns 0 if not executable
 		*/
 		uint8_t isSectionExecutable(uint32_t sectionID) {
-			if (validSection(sectionID)) {
-				return sectionInfoTable[sectionID].offset & 0x1;
-			}
-			return 0;
+			ReadLock lock(imageLock);
+			return sectionExecutable(sectionID);
 		}
 
 		/*
 			Write a 4-byte <value> to the specified <offset> relative to the  <sectionID>'s offset
 		*/
 		void writeToSection(uint32_t sectionID, uint32_t offset, uint32_t value) {
+			WriteLock lock(imageLock);
 			if (validSection(sectionID)) {
-				relFile.seekg(toAddress(sectionInfoTable[sectionID].offset, offset), std::fstream::beg);
-				writeBigInt(relFile, value);
+				write(toAddress(sectionInfoTable[sectionID].offset, offset), &value, 1);
 			}
 		}
 
@@ -112,9 +284,9 @@ namespace RELPatch {
 			Write a 2-byte <value> to the specified <offset> relative to the  <sectionID>'s offset
 		*/
 		void writeToSection(uint32_t sectionID, uint32_t offset, uint16_t value) {
+			WriteLock lock(imageLock);
 			if (validSection(sectionID)) {
-				relFile.seekg(toAddress(sectionInfoTable[sectionID].offset, offset), std::fstream::beg);
-				writeBigShort(relFile, value);
+				write(toAddress(sectionInfoTable[sectionID].offset, offset), &value, 1);
 			}
 		}
 
@@ -122,9 +294,9 @@ namespace RELPatch {
 			Write a 1-byte <value> to the specified <offset> relative to the section id's offset
 		*/
 		void writeToSection(uint32_t sectionID, uint32_t offset, uint8_t value) {
+			WriteLock lock(imageLock);
 			if (validSection(sectionID)) {
-				relFile.seekg(toAddress(sectionInfoTable[sectionID].offset, offset), std::fstream::beg);
-				writeBigByte(relFile, value);
+				write(toAddress(sectionInfoTable[sectionID].offset, offset), &value, 1);
 			}
 		}
 
@@ -132,6 +304,7 @@ namespace RELPatch {
 			Write a series of <count> 4-byte <values> to the specified <offset> relative to the <sectionID>'s offset
 		*/
 		void writeToSection(uint32_t sectionID, uint32_t offset, uint32_t *values, int32_t count) {
+			WriteLock lock(imageLock);
 			if(validSection(sectionID)) {
 				write(toAddress(sectionInfoTable[sectionID].offset, offset), values, count);
 			}
@@ -141,6 +314,7 @@ namespace RELPatch {
 			Write a series of <count> 2-byte <values> to the specified <offset> relative to the <sectionID>'s offset
 		*/
 		void writeToSection(uint32_t sectionID, uint32_t offset, uint16_t *values, int32_t count) {
+			WriteLock lock(imageLock);
 			if (validSection(sectionID)) {
 				write(toAddress(sectionInfoTable[sectionID].offset, offset), values, count);
 			}
@@ -150,52 +324,202 @@ namespace RELPatch {
 			Write a series of <count> 1-byte <values> to the specified <offset> relative to the <sectionID>'s offset
 		*/
 		void writeToSection(uint32_t sectionID, uint32_t offset, uint8_t *values, int32_t count) {
+			WriteLock lock(imageLock);
 			if(validSection(sectionID)) {
 				write(toAddress(sectionInfoTable[sectionID].offset, offset), values, count);
 			}
 		}
 
+		/*
+			Write a 4, 2 or 1-byte <value> to <offset> relative to the symbol <symbolName>
+			Nothing is written if the symbol isn't loaded
+		*/
+		void writeToSection(std::string const& symbolName, uint32_t offset, uint32_t value) {
+			Symbol symbol = resolveSymbol(symbolName);
+			writeToSection(symbol.sectionID, symbol.offset + offset, value);
+		}
+
+		void writeToSection(std::string const& symbolName, uint32_t offset, uint16_t value) {
+			Symbol symbol = resolveSymbol(symbolName);
+			writeToSection(symbol.sectionID, symbol.offset + offset, value);
+		}
+
+		void writeToSection(std::string const& symbolName, uint32_t offset, uint8_t value) {
+			Symbol symbol = resolveSymbol(symbolName);
+			writeToSection(symbol.sectionID, symbol.offset + offset, value);
+		}
+
+		/*
+			Write a series of <count> 4, 2 or 1-byte <values> to <offset> relative to the symbol <symbolName>
+			Nothing is written if the symbol isn't loaded
+		*/
+		void writeToSection(std::string const& symbolName, uint32_t offset, uint32_t *values, int32_t count) {
+			Symbol symbol = resolveSymbol(symbolName);
+			writeToSection(symbol.sectionID, symbol.offset + offset, values, count);
+		}
+
+		void writeToSection(std::string const& symbolName, uint32_t offset, uint16_t *values, int32_t count) {
+			Symbol symbol = resolveSymbol(symbolName);
+			writeToSection(symbol.sectionID, symbol.offset + offset, values, count);
+		}
+
+		void writeToSection(std::string const& symbolName, uint32_t offset, uint8_t *values, int32_t count) {
+			Symbol symbol = resolveSymbol(symbolName);
+			writeToSection(symbol.sectionID, symbol.offset + offset, values, count);
+		}
+
+		/*
+			Write the 24-bit branch displacement <value> into the b/bl instruction at <offset> in <sectionID> (opcode and AA/LK bits are kept)
+		*/
+		void writeToSection24(uint32_t sectionID, uint32_t offset, uint32_t value) {
+			writeField<Field24>(sectionID, offset, value);
+		}
+
+		/*
+			Write the high 16 bits of <value> into the immediate of the instruction at <offset> in <sectionID> (addis before an ori)
+		*/
+		void writeToSection16HI(uint32_t sectionID, uint32_t offset, uint32_t value) {
+			writeField<Field16>(sectionID, offset, hi(value));
+		}
+
+		/*
+			Write the high 16 bits of <value> adjusted for a signed low half into the immediate of the instruction at <offset> in <sectionID>
+			(addis before an addi/lwz/stw/...)
+		*/
+		void writeToSection16HA(uint32_t sectionID, uint32_t offset, uint32_t value) {
+			writeField<Field16>(sectionID, offset, ha(value));
+		}
+
+		/*
+			Write the low 16 bits of <value> into the immediate of the instruction at <offset> in <sectionID>
+		*/
+		void writeToSection16LO(uint32_t sectionID, uint32_t offset, uint32_t value) {
+			writeField<Field16>(sectionID, offset, lo(value));
+		}
+
+		/*
+			Write the 14-bit branch displacement <value> into the bc instruction at <offset> in <sectionID> (AA/LK bits are kept)
+		*/
+		void writeToSection14(uint32_t sectionID, uint32_t offset, uint32_t value) {
+			writeField<Field14>(sectionID, offset, value);
+		}
+
+		/*
+			Write <value> into the <Field> of the instruction at <offset> in <sectionID> (see patchInstructions)
+		*/
+		template <typename Field>
+		void writeField(uint32_t sectionID, uint32_t offset, uint32_t value) {
+			patchInstructions(std::vector<InstructionPatch>(1, fieldPatch<Field>(sectionID, offset, value)));
+		}
+
+		/*
+			Applies every patch in <patches> in one sorted pass over the rel file
+			Every touched instruction is read and written once and neighbouring instructions are written together
+			Patches of the same instruction are applied in the order given
+			Patches to invalid sections, unaligned offsets or offsets past the end of the section are skipped
+			Relocations of the module that would overwrite patched bits when it is linked are turned into R_PPC_NONE entries
+			(a hook on a bl keeps its branch instead of getting the original target linked back in)
+			Returns the number of instructions written
+		*/
+		uint32_t patchInstructions(std::vector<InstructionPatch> const& patches) {
+			WriteLock lock(imageLock);
+			return applyInstructionPatches(patches);
+		}
+
+		/*
+			Replaces the instruction of every hook with a b/bl to the hook's target in one pass (see patchInstructions)
+			Hooks whose target is out of the range of a branch are skipped. Relocations of the replaced instructions are disabled
+			Returns the number of instructions written
+		*/
+		uint32_t injectBranches(std::vector<BranchHook> const& hooks) {
+			WriteLock lock(imageLock);
+			std::vector<InstructionPatch> patches;
+			patches.reserve(hooks.size());
+			for (size_t i = 0; i < hooks.size(); i++) {
+				BranchHook const& hook = hooks[i];
+				if (!validSection(hook.sectionID) || !validSection(hook.targetSectionID)) {
+					continue;
+				}
+				uint32_t from = (uint32_t)toAddress(sectionInfoTable[hook.sectionID].offset, hook.offset);
+				uint32_t to = (uint32_t)toAddress(sectionInfoTable[hook.targetSectionID].offset, hook.targetOffset);
+				if (!branchInRange(from, to)) {
+					continue;
+				}
+				patches.push_back(fieldPatch<WordField>(hook.sectionID, hook.offset, branchInstruction(from, to, hook.link)));
+			}
+			return applyInstructionPatches(patches);
+		}
+
 		/*
 			Moves the <sectionID>'s section to the back of the file
 			This will increase the filesize, so be careful about using it multiple times
 			Especially if it is used multiple times on one <sectionID>
 		*/
 		void moveSectionToEnd(uint32_t sectionID) {
+			WriteLock lock(imageLock);
 			if (validSection(sectionID)) {
 				// The new section will now be at the current end of the file
-				std::streamoff newSectionOffset = filesize();
-				uint8_t isExecutable = isSectionExecutable(sectionID);
-
-				// Promoted to int64 to avoid unsigned ambiguities
-				int64_t offset = toAddress(sectionInfoTable[sectionID].offset);
+				std::streamoff newSectionOffset = (std::streamoff)image.size();
+				uint8_t isExecutable = sectionExecutable(sectionID);
 				
 				copyData(toAddress(sectionInfoTable[sectionID].offset), (int64_t)newSectionOffset, sectionInfoTable[sectionID].size);
 
 				// Update our stored section offset
 				sectionInfoTable[sectionID].offset = toSectionOffsetFormat((uint32_t)newSectionOffset, isExecutable);
-				std::cout << sectionInfoTable[sectionID].offset << std::endl;
 				// Update the rel file's section offset
-				relFile.seekg(header->sectionInfoOffset + (0x8 * sectionID), std::fstream::beg);
-				writeBigInt(relFile, sectionInfoTable[sectionID].offset);
+				write(header->sectionInfoOffset + (0x8 * sectionID), &sectionInfoTable[sectionID].offset, 1);
 			}
 		}
 
 		/*
-			Resizes <sectionID> to <newSize>
-			No bounds/overlap checks are done
+			Removes the unused space between sections and tables (such as the space left behind by moveSectionToEnd)
+			Sections keep their order and alignment and are followed by the tables in their original order
+			Every block is copied once and the header, section info table and import table are updated
+			Returns the new filesize or -1 if blocks of the file overlap each other
 		*/
-		uint32_t resizeSectionUnsafe(uint32_t sectionID, uint32_t newSize) {
-			if (validSection(sectionID) && newSize > 0) {
-				// Update our stored section offset
-				sectionInfoTable[sectionID].size = newSize;
+		std::streamoff repack() {
+			WriteLock lock(imageLock);
+			std::vector<LayoutBlock> blocks;
+			if (!layoutBlocks(blocks)) {
+				return -1;
+			}
 
-				// Update the rel file's section offset
-				relFile.seekg(header->sectionInfoOffset + (0x8 * sectionID) + 0x4, std::fstream::beg);
-				writeBigInt(relFile, sectionInfoTable[sectionID].size);
+			// Headers come first, then the sections and then the tables. Blocks of the same kind keep their order
+			std::stable_sort(blocks.begin(), blocks.end(), [](LayoutBlock const& a, LayoutBlock const& b) {
+				return layoutRank(a.type) < layoutRank(b.type);
+			});
 
-				return sectionInfoTable[sectionID].size;
+			std::vector<uint32_t> newOffsets(blocks.size());
+			uint32_t end = 0;
+			for (size_t i = 0; i < blocks.size(); i++) {
+				newOffsets[i] = alignUp(end, blocks[i].alignment);
+				end = newOffsets[i] + blocks[i].size;
 			}
-			return 0xFFFFFFFF;
+			end = alignUp(end, 4);
+
+			// Copy every block into the new image once
+			std::vector<char> repacked(end, 0);
+			for (size_t i = 0; i < blocks.size(); i++) {
+				if (blocks[i].size > 0) {
+					memcpy(&repacked[newOffsets[i]], &image[blocks[i].offset], blocks[i].size);
+				}
+				moveLayoutBlock(blocks[i], newOffsets[i]);
+			}
+
+			preserve(0, image.size());
+			image.swap(repacked);
+			encodeTables();
+			rewriteFile();
+			return (std::streamoff)image.size();
+		}
+
+		/*
+			Resizes <sectionID> to <newSize>
+			No bounds/overlap checks are done
+		*/
+		uint32_t resizeSectionUnsafe(uint32_t sectionID, uint32_t newSize) {
+			WriteLock lock(imageLock);
+			return writeSectionSize(sectionID, newSize);
 		}
 
 		/*
@@ -204,8 +528,9 @@ namespace RELPatch {
 			No bounds/overlap checks are done
 		*/
 		uint32_t expandSectionUnsafe(uint32_t sectionID, uint32_t amount) {
+			WriteLock lock(imageLock);
 			if (validSection(sectionID) && amount > 0) {
-				return resizeSectionUnsafe(sectionID, sectionInfoTable[sectionID].size + amount);
+				return writeSectionSize(sectionID, sectionInfoTable[sectionID].size + amount);
 			}
 			return 0xFFFFFFFF;
 		}
@@ -216,13 +541,37 @@ namespace RELPatch {
 			No bounds/overlap checks are done
 		*/
 		uint32_t expandSectionUnsafeRounded(uint32_t sectionID, uint32_t amount) {
+			WriteLock lock(imageLock);
 			if (validSection(sectionID) && amount > 0) {
 				uint32_t newSize = sectionInfoTable[sectionID].size;
 				if (newSize % 4 != 0) {
 					newSize += 4 - (newSize % 4);
 				}
 				newSize += amount;
-				return resizeSectionUnsafe(sectionID, newSize);
+				return writeSectionSize(sectionID, newSize);
+			}
+			return 0xFFFFFFFF;
+		}
+
+		/*
+			Resizes <sectionID> to <newSize> without overlapping anything after it
+			If the section doesn't fit anymore, everything after it is shifted back in one move (keeping 32 byte alignment)
+			and the header (including the v3 fixSize offset), section info table and import table offsets are updated
+			The added bytes are zeroed. Shrinking only changes the size (use repack to reclaim the space)
+			Returns the new size or -1 on invalid <sectionID> or a file with overlapping blocks
+		*/
+		uint32_t resizeSection(uint32_t sectionID, uint32_t newSize) {
+			WriteLock lock(imageLock);
+			return resizeSectionInPlace(sectionID, newSize);
+		}
+
+		/*
+			Expands <sectionID> by <amount> without overlapping anything after it (see resizeSection)
+		*/
+		uint32_t expandSection(uint32_t sectionID, uint32_t amount) {
+			WriteLock lock(imageLock);
+			if (validSection(sectionID) && amount > 0) {
+				return resizeSectionInPlace(sectionID, sectionInfoTable[sectionID].size + amount);
 			}
 			return 0xFFFFFFFF;
 		}
@@ -238,6 +587,7 @@ namespace RELPatch {
 		Copy <amount> number of bytes from <sourceOffset> in <sourceSectionID> to <destinationOffset> in <destinationSectionID>
 		*/
 		void copyData(uint32_t sourceSectionID, uint32_t sourceOffset, uint32_t destinationSectionID, uint32_t destinationOffset, uint32_t amount) {
+			WriteLock lock(imageLock);
 			if (validSection(sourceSectionID) && validSection(destinationSectionID)) {
 				int64_t sourceSectionAbsoluteAddress = toAddress(sectionInfoTable[sourceSectionID].offset, sourceOffset);
 				int64_t destinationSectionAbsoluteAddress = toAddress(sectionInfoTable[destinationSectionID].offset, destinationOffset);
@@ -246,37 +596,77 @@ namespace RELPatch {
 			}
 		}
 
+		/*
+			Copy <amount> number of bytes from <sourceOffset> in the symbol <sourceSymbolName> to <destinationOffset> in the symbol <destinationSymbolName>
+			Nothing is copied if either symbol isn't loaded
+		*/
+		void copyData(std::string const& sourceSymbolName, uint32_t sourceOffset, std::string const& destinationSymbolName, uint32_t destinationOffset, uint32_t amount) {
+			Symbol source = resolveSymbol(sourceSymbolName);
+			Symbol destination = resolveSymbol(destinationSymbolName);
+			copyData(source.sectionID, source.offset + sourceOffset, destination.sectionID, destination.offset + destinationOffset, amount);
+		}
+
 		char* readData(uint32_t sourceSectionID, uint32_t sourceOffset, uint32_t amount) {
+			ReadLock lock(imageLock);
 			char *buffer = NULL;
 			if (validSection(sourceSectionID)) {
 				buffer = new char[amount];
-				readData(sourceSectionID, sourceOffset, buffer, amount);
+				readImage(toAddress(sectionInfoTable[sourceSectionID].offset, sourceOffset), buffer, amount);
 			}
 			return buffer;
 		}
 
 		void readData(uint32_t sourceSectionID, uint32_t sourceOffset, char *buffer, uint32_t amount) {
+			ReadLock lock(imageLock);
 			if (validSection(sourceSectionID)) {
-				int64_t signedAmount = (int64_t)amount;
-				relFile.seekg(toAddress(sectionInfoTable[sourceSectionID].offset, sourceOffset), std::fstream::beg);
-
-				relFile.read(buffer, (std::streamsize) amount);
+				readImage(toAddress(sectionInfoTable[sourceSectionID].offset, sourceOffset), buffer, amount);
 			}
 		}
 
+		/*
+			Gets a view of <count> <T>s at <offset> in <sectionID> that points straight into the in-memory image
+			<T> has to be built from be<> fields (or single bytes) so it can sit at any offset
+			Returns an empty view on invalid <sectionID> or if the range goes past the end of the section
+			The view (and every copy of it) holds a read lock on the rel file, so functions that modify it wait until the view is gone
+			Don't modify the rel file from a thread that still holds a view, it would wait on itself
+		*/
+		template <typename T>
+		SectionView<const T> sectionView(uint32_t sectionID, uint32_t offset, uint32_t count) {
+			std::shared_ptr<ReadLock> lock = std::make_shared<ReadLock>(imageLock);
+			return viewSection<T>(sectionID, offset, count, lock);
+		}
+
+		/*
+			Gets a view of every whole <T> in <sectionID> (see sectionView above)
+		*/
+		template <typename T>
+		SectionView<const T> sectionView(uint32_t sectionID) {
+			std::shared_ptr<ReadLock> lock = std::make_shared<ReadLock>(imageLock);
+			uint32_t count = validSection(sectionID) ? sectionInfoTable[sectionID].size / (uint32_t)sizeof(T) : 0;
+			return viewSection<T>(sectionID, 0, count, lock);
+		}
+
 		void writeData(uint32_t destinationSectionID, uint32_t destinationOffset, char *buffer, uint32_t amount) {
+			WriteLock lock(imageLock);
 			if (validSection(destinationSectionID)) {
-				int64_t signedAmount = (int64_t)amount;
-				relFile.seekg(toAddress(sectionInfoTable[destinationSectionID].offset, destinationOffset), std::fstream::beg);
-
-				relFile.write(buffer, (std::streamsize) amount);
+				writeImage(toAddress(sectionInfoTable[destinationSectionID].offset, destinationOffset), buffer, amount);
 			}
 		}
 
+		/*
+			Write <amount> bytes of <buffer> to <destinationOffset> relative to the symbol <symbolName>
+			Nothing is written if the symbol isn't loaded
+		*/
+		void writeData(std::string const& symbolName, uint32_t destinationOffset, char *buffer, uint32_t amount) {
+			Symbol symbol = resolveSymbol(symbolName);
+			writeData(symbol.sectionID, symbol.offset + destinationOffset, buffer, amount);
+		}
+
 		/*
 			Finds a list of relocation entries that point to <offset> within <sectionID>
 		*/
 		std::vector<RelocationTable> findPointerAddresses(uint32_t sectionID, uint32_t offset) {
+			ReadLock lock(imageLock);
 			if (validSection(sectionID) && offset < toAddress(sectionInfoTable[sectionID].size)) {
 				return findPointers(sectionID, offset);
 			}
@@ -288,6 +678,7 @@ namespace RELPatch {
 			Finds a list of relocation entries that point to <offset> within <sectionID> with an error range of <tolerance> bytes
 		*/
 		std::vector<RelocationTable> findPointerAddresses(uint32_t sectionID, uint32_t offset, uint32_t tolerance) {
+			ReadLock lock(imageLock);
 			if (validSection(sectionID) && offset < toAddress(sectionInfoTable[sectionID].size)) {
 				return findPointers(sectionID, offset, tolerance);
 			}
@@ -295,306 +686,1399 @@ namespace RELPatch {
 			return empty;
 		}
 
-		////////
-
 		/*
-		Gets the offset of the relocations
+			Finds a list of relocation entries that point to <offset> within the symbol <symbolName> (see findPointerAddresses above)
 		*/
-		uint32_t relocationsOffset() {
-			return header->relocationTableOffset;
+		std::vector<RelocationTable> findPointerAddresses(std::string const& symbolName, uint32_t offset = 0, uint32_t tolerance = 0) {
+			Symbol symbol = resolveSymbol(symbolName);
+			return findPointerAddresses(symbol.sectionID, symbol.offset + offset, tolerance);
 		}
 
 		/*
-			Write a 4-byte <value> to the specified <offset> relative to the start of the relocations
+			Pairs every entry of <relocations> with the symbol that the pointer is stored in
 		*/
-		void writeToRelocations(uint32_t offset, uint32_t value) {
-			relFile.seekg(toAddress(header->relocationTableOffset, offset), std::fstream::beg);
-			writeBigInt(relFile, value);
+		std::vector<SymbolizedPointer> symbolizePointers(std::vector<RelocationTable> const& relocations) {
+			ReadLock lock(imageLock);
+			std::vector<SymbolizedPointer> symbolized(relocations.size());
+			for (size_t i = 0; i < relocations.size(); i++) {
+				symbolized[i].relocation = relocations[i];
+				symbolized[i].symbol = symbolMap.at(relocations[i].destinationSectionIndex, relocations[i].destinationSectionOffset);
+				symbolized[i].symbolOffset = symbolized[i].symbol == NULL ? 0 : relocations[i].destinationSectionOffset - symbolized[i].symbol->offset;
+			}
+			return symbolized;
 		}
 
 		/*
-			Write a 2-byte <value> to the specified <offset> relative to the start of the relocations
+			Finds space in the existing sections that can be reused without moving sections or growing the file:
+			alignment padding behind sections, runs of zero words in executable sections and (with symbols loaded) functions and data nothing in the module points to
+			Bytes patched by relocations are never part of a cave. References from other modules can't be seen, so only load symbols that aren't exported
+			Caves smaller than <minimumSize> bytes are left out
 		*/
-		void writeToRelocations(uint32_t offset, uint16_t value) {
-			relFile.seekg(toAddress(header->relocationTableOffset, offset), std::fstream::beg);
-			writeBigShort(relFile, value);
+		std::vector<CodeCave> findCodeCaves(uint32_t minimumSize = 16) {
+			ReadLock lock(imageLock);
+			std::vector<CodeCave> caves;
+			scanCodeCaves(minimumSize, caves);
+			return caves;
 		}
 
 		/*
-			Write a 1-byte <value> to the specified <offset> relative to the start of the relocations
+			Takes <size> bytes aligned to <alignment> from the code caves (see findCodeCaves) for new code (<executable>) or data
+			Space taken from the padding behind a section grows the section's size to cover it
+			Returns a placement with a section of 0xFFFFFFFF if no cave is large enough
 		*/
-		void writeToRelocations(uint32_t offset, uint8_t value) {
-			relFile.seekg(toAddress(header->relocationTableOffset, offset), std::fstream::beg);
-			writeBigByte(relFile, value);
+		CodePlacement allocate(uint32_t size, uint32_t alignment, bool executable) {
+			WriteLock lock(imageLock);
+			CodePlacement placement = codeCaves().allocate(size, alignment, executable);
+			if (placement.sectionID == 0xFFFFFFFF) {
+				return placement;
+			}
+			redoSnapshots.clear();
+			codeCaveAllocations.push_back(std::make_pair(placement, size));
+			if ((uint64_t)placement.offset + size > sectionInfoTable[placement.sectionID].size) {
+				writeSectionSize(placement.sectionID, placement.offset + size);
+				// The allocator already accounts for the new size
+				codeCavesStale = false;
+			}
+			return placement;
 		}
 
 		/*
-			Write a series of <count> 4-byte <values> to the specified <offset> relative to the start of the relocations
+			The caves allocate still has free
 		*/
-		void writeToRelocations(uint32_t offset, uint32_t *values, int32_t count) {
-			write(toAddress(header->relocationTableOffset, offset), values, count);
+		std::vector<CodeCave> freeCodeCaves() {
+			WriteLock lock(imageLock);
+			return codeCaves().caves();
 		}
 
 		/*
-			Write a series of <count> 2-byte <values> to the specified <offset> relative to the start of the relocations
+			Copies the sections and decoded relocations of the module (plus the starts of the loaded symbols) for ModuleDiff
 		*/
-		void writeToRelocations(uint32_t offset, uint16_t *values, int32_t count) {
-			write(toAddress(header->relocationTableOffset, offset), values, count);
+		ModuleContents contents() {
+			ReadLock lock(imageLock);
+			ModuleContents module;
+			module.moduleID = header->moduleID;
+			std::vector<uint32_t> sectionIndices(header->sectionCount, 0xFFFFFFFF);
+			for (uint32_t i = 0; i < header->sectionCount; i++) {
+				uint32_t offset = toAddress(sectionInfoTable[i].offset);
+				if (!validSection(i) || (uint64_t)offset + sectionInfoTable[i].size > image.size()) {
+					continue;
+				}
+				sectionIndices[i] = (uint32_t)module.sections.size();
+				ModuleSection section;
+				section.sectionID = i;
+				section.executable = sectionExecutable(i);
+				section.data.assign(image.begin() + offset, image.begin() + offset + sectionInfoTable[i].size);
+				module.sections.push_back(section);
+			}
+
+			const RelocationIndex &index = relocations();
+			for (size_t i = 0; i < index.imports.size(); i++) {
+				const ImportRange &import = index.imports[i];
+				for (uint32_t j = import.first; j < import.first + import.count; j++) {
+					uint8_t relocationType = index.types[j];
+					if (relocationType == (uint8_t)RelocationType::R_PPC_NONE || relocationType > (uint8_t)RelocationType::R_PPC_REL14
+						|| index.destinationSections[j] >= header->sectionCount || sectionIndices[index.destinationSections[j]] == 0xFFFFFFFF) {
+						continue;
+					}
+					ModuleRelocation relocation;
+					relocation.offset = index.destinationOffsets[j];
+					relocation.relocationType = relocationType;
+					relocation.targetSection = index.sections[j];
+					relocation.moduleID = import.moduleID;
+					relocation.targetOffset = index.symbolOffsets[j];
+					module.sections[sectionIndices[index.destinationSections[j]]].relocations.push_back(relocation);
+				}
+			}
+			for (size_t i = 0; i < symbolMap.size(); i++) {
+				uint32_t sectionID = symbolMap[i].sectionID;
+				if (sectionID < header->sectionCount && sectionIndices[sectionID] != 0xFFFFFFFF) {
+					module.sections[sectionIndices[sectionID]].symbolStarts.push_back(symbolMap[i].offset);
+				}
+			}
+			for (size_t i = 0; i < module.sections.size(); i++) {
+				std::stable_sort(module.sections[i].relocations.begin(), module.sections[i].relocations.end(), [](ModuleRelocation const& a, ModuleRelocation const& b) {
+					return a.offset < b.offset;
+				});
+			}
+			return module;
 		}
 
 		/*
-			Write a series of <count> 1-byte <values> to the specified <offset> relative to the start of the relocations
+			Matches the functions and data of this module against <newer>, another version of the same module
+			The result translates offsets (and patch lists) from this module to <newer>
 		*/
-		void writeToRelocations(uint32_t offset, uint8_t *values, int32_t count) {
-			write(toAddress(header->relocationTableOffset, offset), values, count);
+		ModuleDiff diff(RELFile &newer) {
+			ModuleContents oldModule = contents();
+			ModuleContents newModule = newer.contents();
+			return ModuleDiff::match(oldModule, newModule);
 		}
 
-	private:
-
 		/*
-			Converts a <raw> rel position into an absolute offset
-			This is done by zeroing out the least significant bit (the executable bit)
+			Every relocation of the module as a reference from the address it patches to the address it points to
 		*/
-		uint32_t toAddress(uint32_t raw) {
-			return raw & (~1);
+		std::vector<ModuleReference> references() {
+			ReadLock lock(imageLock);
+			std::vector<ModuleReference> moduleReferences;
+			const RelocationIndex &index = relocations();
+			moduleReferences.reserve(index.size());
+			for (size_t i = 0; i < index.imports.size(); i++) {
+				const ImportRange &import = index.imports[i];
+				for (uint32_t j = import.first; j < import.first + import.count; j++) {
+					uint8_t relocationType = index.types[j];
+					if (relocationType == (uint8_t)RelocationType::R_PPC_NONE || relocationType > (uint8_t)RelocationType::R_PPC_REL14
+						|| index.destinationSections[j] >= header->sectionCount) {
+						continue;
+					}
+					ModuleReference reference;
+					reference.site.moduleID = header->moduleID;
+					reference.site.sectionID = index.destinationSections[j];
+					reference.site.offset = index.destinationOffsets[j];
+					reference.target.moduleID = import.moduleID;
+					reference.target.sectionID = import.moduleID == 0 ? 0 : index.sections[j];
+					reference.target.offset = index.symbolOffsets[j];
+					reference.relocationType = relocationType;
+					moduleReferences.push_back(reference);
+				}
+			}
+			return moduleReferences;
 		}
 
 		/*
-			Combines a <raw> rel position with an <offset> into an absolute offset
-			This is done by zeroing out the least significant bit (the executable bit) and adding the <offset>
+			Reads the rel files <filenames> on <threads> threads (0 = one per core) and builds the graph of every reference between them and into the DOL
+			The files are only read. Files that can't be read or fail the structural checks are left out of the graph
 		*/
-		std::streamoff toAddress(uint32_t raw, uint32_t offset) {
-			return (std::streamoff) (int64_t)((raw & (~1)) + offset);
+		static ReferenceGraph referenceGraph(std::vector<std::string> const& filenames, uint32_t threads = 0) {
+			std::vector<uint32_t> moduleIDs(filenames.size(), 0xFFFFFFFF);
+			std::vector<std::vector<ModuleReference>> moduleReferences(filenames.size());
+			std::atomic<size_t> nextFile(0);
+			auto loadModules = [&]() {
+				for (size_t i = nextFile++; i < filenames.size(); i = nextFile++) {
+					std::ifstream input(filenames[i], std::ios::binary | std::ios::ate);
+					if (!input.is_open()) {
+						continue;
+					}
+					std::vector<char> fileImage((size_t)input.tellg());
+					input.seekg(0, std::ios::beg);
+					input.read(fileImage.data(), (std::streamsize)fileImage.size());
+					if (!input) {
+						continue;
+					}
+					RELFile module(filenames[i], std::move(fileImage));
+					if (module.isValid()) {
+						moduleReferences[i] = module.references();
+						moduleIDs[i] = module.header->moduleID;
+					}
+				}
+			};
+
+			if (threads == 0) {
+				threads = std::max(1u, std::thread::hardware_concurrency());
+			}
+			std::vector<std::thread> loaders;
+			for (uint32_t i = 1; i < threads && i < filenames.size(); i++) {
+				loaders.push_back(std::thread(loadModules));
+			}
+			loadModules();
+			for (size_t i = 0; i < loaders.size(); i++) {
+				loaders[i].join();
+			}
+			return ReferenceGraph(moduleIDs, moduleReferences);
 		}
 
+		////////
+
 		/*
-			Combines an absolute <offset> and a boolean of if the address <isExecutable> into a raw rel position
+			Loads the symbols of a CodeWarrior linker map or a symbol file ("sectionID offset size name" per line) so functions can take symbol names
+			Can be called with several files, the first symbol loaded wins when names repeat
+			Returns the number of symbols added, or 0xFFFFFFFF if the file couldn't be read
 		*/
-		uint32_t toSectionOffsetFormat(uint32_t offset, uint8_t isExecutable) {
-			uint32_t address = toAddress(offset);
-			uint32_t orValue = address | isExecutable;
-			return orValue;
+		uint32_t loadSymbols(std::string const& mapPath) {
+			WriteLock lock(imageLock);
+			redoSnapshots.clear();
+			codeCavesStale = true;
+			return symbolMap.load(mapPath);
 		}
 
 		/*
-			Checks if a <sectionID> is valid
-			A <sectionID> is valid if it exists in the rel file and has an offset other than 0
+			Finds the symbol called <symbolName>
+			Returns NULL if it isn't loaded. The symbol stays in place when more maps are loaded and is freed by clearSymbols
 		*/
-		bool validSection(uint32_t sectionID) {
-			if (sectionID < header->sectionCount && sectionInfoTable[sectionID].offset != 0) {
-				return true;
-			}
-			return false;
+		const Symbol* findSymbol(std::string const& symbolName) {
+			ReadLock lock(imageLock);
+			return symbolMap.find(symbolName);
 		}
 
 		/*
-			Copies <amount> bytes from absolute address <sourceOffset> to absolute address <destinationOffset>
+			Finds the symbol that covers <offset> in <sectionID>
+			Returns NULL if no loaded symbol covers it. The symbol stays in place when more maps are loaded and is freed by clearSymbols
 		*/
-		void copyData(int64_t sourceOffset, int64_t destinationOffset, int64_t amount) {
-			int64_t maxBufferSize = 1 << 17; // 128 KiB
-			int64_t bufferSize;
-			
-			int64_t distance = destinationOffset - sourceOffset;
-			if (distance < maxBufferSize) {
-				// Destination after source and source/destination overlap
-				if(distance > amount){
-					// Make sure we copy data without overlap
-					// At most we can copy distance data at a time (working from the end backwards)
-
-					int64_t tempSourceOffset = sourceOffset + amount - distance;
-					int64_t tempDestinationOffset = destinationOffset + amount - distance;
-					while (tempSourceOffset >= sourceOffset) {
-						copyData(tempSourceOffset, tempDestinationOffset, distance, distance);
-
-						tempSourceOffset -= distance;
-						tempDestinationOffset -= distance;
-					}
-					return;
-				}
-				else {
-					bufferSize = distance;
-				}
-			}
-			else {
-				bufferSize = maxBufferSize;
-
-			}
-			copyData(sourceOffset, destinationOffset, amount, bufferSize);
+		const Symbol* symbolAt(uint32_t sectionID, uint32_t offset) {
+			ReadLock lock(imageLock);
+			return symbolMap.at(sectionID, offset);
 		}
 
-
 		/*
-			Copies <amount> bytes from absolute address <sourceOffset> to absolute address <destinationOffset>
-			Copy at most <maxBufferSize> bytes at a time
+			Number of symbols loaded
 		*/
-		void copyData(int64_t sourceOffset, int64_t destinationOffset, int64_t amount, int64_t maxBufferSize) {
-			// Promoted to int64 to avoid unsigned ambiguities
-			int64_t bytesLeft = amount;
-			int64_t bytesWritten = 0;
-			int64_t buffserSize;
-			if (bytesLeft < maxBufferSize) {
-				buffserSize = bytesLeft;
-			}
-			else {
-				buffserSize = maxBufferSize;
-
-			}
-			// Allocate our buffer
-			std::unique_ptr<char[]> buffer = std::make_unique<char[]>((size_t)buffserSize);
-
-			// Loop until nothing is left
-			while (bytesLeft > 0) {
-				relFile.seekg(sourceOffset + bytesWritten, std::fstream::beg);
-
-				// Make sure not to read more than there is
-				if (bytesLeft < maxBufferSize) {
-					buffserSize = bytesLeft;
-				}
-				else {
-					buffserSize = maxBufferSize;
-				}
-
-				// Read in the buffer
-				relFile.read(buffer.get(), buffserSize);
-				bytesLeft -= buffserSize;
-
-				// Seek to the end and write out the buffer
-				relFile.seekg(destinationOffset + bytesWritten, std::fstream::beg);
-				relFile.write(buffer.get(), buffserSize);
-				bytesWritten += buffserSize;
-			}
+		size_t symbolCount() {
+			ReadLock lock(imageLock);
+			return symbolMap.size();
 		}
 
 		/*
-			Write a series of <count> 4-byte <values> to the rel file at the specified <offset>
+			Removes every loaded symbol
+			Every symbol pointer handed out before (findSymbol, symbolAt, symbolizePointers) becomes invalid, so no other thread may still be using one
 		*/
-		void write(std::streamoff offset, uint32_t *values, int32_t count) {
-			relFile.seekg(offset, std::fstream::beg);
-			for (int32_t i = 0; i < count; i++) {
-				writeBigInt(relFile, values[i]);
-			}
+		void clearSymbols() {
+			WriteLock lock(imageLock);
+			preserveSymbols();
+			codeCavesStale = true;
+			symbolMap.clear();
 		}
 
+		////////
+
 		/*
-			Write a series of <count> 2-byte <values> to the rel file at the specified <offset>
+		Gets the offset of the relocations
 		*/
-		void write(std::streamoff offset, uint16_t *values, int32_t count) {
-			relFile.seekg(offset, std::fstream::beg);
-			for (int32_t i = 0; i < count; i++) {
-				writeBigShort(relFile, values[i]);
+		uint32_t relocationsOffset() {
+			ReadLock lock(imageLock);
+			return header->relocationTableOffset;
+		}
+
+		/*
+			Gets the number of relocation entries in every import (including section switches and end markers)
+		*/
+		uint32_t relocationCount() {
+			ReadLock lock(imageLock);
+			return relocations().size();
+		}
+
+		/*
+			Gets the number of bytes used by the decoded relocations of this rel file
+		*/
+		size_t relocationIndexMemoryUsage() {
+			ReadLock lock(imageLock);
+			return relocations().memoryUsage();
+		}
+
+		/*
+			Loads the decoded relocations from the sidecar file <cachePath> instead of decoding them
+			If the sidecar is missing or was written for a different version of the rel file the relocations are decoded and the sidecar is written again
+			Returns true if the sidecar could be used
+		*/
+		bool useRelocationCache(std::string const& cachePath) {
+			WriteLock lock(imageLock);
+			relFile.flush();
+			RelocationCacheKey cacheKey = RelocationCache::key(filename, image, *header, headerSize());
+			if (RelocationCache::load(cachePath, cacheKey, relocationIndex)) {
+				relocationIndexStale.store(false, std::memory_order_release);
+				return true;
 			}
+			RelocationCache::save(cachePath, cacheKey, relocations());
+			return false;
 		}
 
 		/*
-			Write a series of <count> 1-byte <values> to the rel file at the specified <offset>
+			Loads the decoded relocations from the sidecar file next to the rel file (<filename>.relidx)
 		*/
-		void write(std::streamoff offset, uint8_t *values, int32_t count) {
-			relFile.seekg(offset, std::fstream::beg);
-			for (int32_t i = 0; i < count; i++) {
-				writeBigByte(relFile, values[i]);
+		bool useRelocationCache() {
+			return useRelocationCache(filename + ".relidx");
+		}
+
+		/*
+			Rewrites the import table and relocations in their smallest form
+			Imports of the same module are merged (keeping the order each module first appears in),
+			entries are sorted by destination, R_PPC_NONE entries, exact duplicates, redundant section switches and nops are removed
+			The tables are written back in place so the file keeps its size (use repack to reclaim the freed space)
+			Nothing is changed if the result wouldn't fit in place
+		*/
+		RelocationOptimizationReport optimizeRelocations() {
+			WriteLock lock(imageLock);
+			const RelocationIndex &index = relocations();
+
+			RelocationOptimizationReport report;
+			report.entriesBefore = index.size();
+			report.entriesAfter = index.size();
+			report.importsBefore = header->importTableCount;
+			report.importsAfter = header->importTableCount;
+
+			std::vector<LayoutBlock> blocks;
+			if (header->importTableCount == 0 || !layoutBlocks(blocks)) {
+				report.bytesBefore = header->importTableSize;
+				report.bytesAfter = header->importTableSize;
+				return report;
+			}
+			LayoutBlock relocationBlock = blocks[0];
+			for (size_t i = 0; i < blocks.size(); i++) {
+				if (blocks[i].type == LayoutBlockType::RELOCATIONS) {
+					relocationBlock = blocks[i];
+				}
+			}
+			report.bytesBefore = header->importTableSize + relocationBlock.size;
+			report.bytesAfter = report.bytesBefore;
+
+			// Gather the real relocations of every module in the order the modules first appear
+			std::vector<uint32_t> moduleIDs;
+			std::vector<std::vector<RelocationTable>> moduleRelocations;
+			for (size_t i = 0; i < index.imports.size(); i++) {
+				const ImportRange &import = index.imports[i];
+				size_t module = std::find(moduleIDs.begin(), moduleIDs.end(), import.moduleID) - moduleIDs.begin();
+				if (module == moduleIDs.size()) {
+					moduleIDs.push_back(import.moduleID);
+					moduleRelocations.emplace_back();
+				}
+				uint32_t end = import.first + import.count;
+				for (uint32_t j = import.first; j < end; j++) {
+					uint8_t type = index.types[j];
+					if (type == (uint8_t)RelocationType::R_PPC_NONE || type >= (uint8_t)RelocationType::R_DOLPHIN_NOP) {
+						continue;
+					}
+					moduleRelocations[module].push_back(index.entry(import, j));
+				}
+			}
+
+			// Sort by destination and encode every module's relocations one after another
+			std::vector<char> encoded;
+			std::vector<uint32_t> encodedOffsets;
+			for (size_t i = 0; i < moduleRelocations.size(); i++) {
+				std::vector<RelocationTable> &entries = moduleRelocations[i];
+				// A stable sort keeps relocations that patch the same place in their original order
+				std::stable_sort(entries.begin(), entries.end(), [](RelocationTable const& a, RelocationTable const& b) {
+					if (a.destinationSectionIndex != b.destinationSectionIndex) {
+						return a.destinationSectionIndex < b.destinationSectionIndex;
+					}
+					return a.destinationSectionOffset < b.destinationSectionOffset;
+				});
+				entries.erase(std::unique(entries.begin(), entries.end(), [](RelocationTable const& a, RelocationTable const& b) {
+					return a.destinationSectionIndex == b.destinationSectionIndex && a.destinationSectionOffset == b.destinationSectionOffset
+						&& a.relocationType == b.relocationType && a.sectionIndex == b.sectionIndex && a.symbolOffset == b.symbolOffset;
+				}), entries.end());
+
+				encodedOffsets.push_back(relocationBlock.offset + (uint32_t)encoded.size());
+				encodeRelocations(entries, encoded);
+			}
+
+			uint32_t newImportTableSize = (uint32_t)moduleIDs.size() * 8;
+			if (encoded.size() > relocationBlock.size || newImportTableSize > header->importTableSize) {
+				return report;
+			}
+
+			// Write the relocations and clear what is left of the old ones
+			uint32_t oldImportTableSize = header->importTableSize;
+			preserve(relocationBlock.offset, relocationBlock.size);
+			preserve(header->importTableOffset, oldImportTableSize);
+			memcpy(&image[relocationBlock.offset], encoded.data(), encoded.size());
+			memset(&image[relocationBlock.offset + encoded.size()], 0, relocationBlock.size - encoded.size());
+			memset(&image[header->importTableOffset], 0, oldImportTableSize);
+
+			header->relocationTableOffset = relocationBlock.offset;
+			header->importTableSize = newImportTableSize;
+			header->importTableCount = (uint32_t)moduleIDs.size();
+			importTable = std::make_unique<ImportTable[]>(header->importTableCount);
+			for (uint32_t i = 0; i < header->importTableCount; i++) {
+				importTable[i].moduleID = moduleIDs[i];
+				importTable[i].relocationsOffset = encodedOffsets[i];
 			}
+			encodeTables();
+
+			flushImage(0, headerSize());
+			flushImage(header->importTableOffset, oldImportTableSize);
+			flushImage(relocationBlock.offset, relocationBlock.size);
+
+			report.bytesAfter = newImportTableSize + (uint32_t)encoded.size();
+			report.entriesAfter = (uint32_t)(encoded.size() / 8);
+			report.importsAfter = header->importTableCount;
+			return report;
 		}
 
 		/*
-			Parses the rel file's headers by calling other helper functions
+			Write a 4-byte <value> to the specified <offset> relative to the start of the relocations
 		*/
-		void parseRel() {
-			parseHeader();
+		void writeToRelocations(uint32_t offset, uint32_t value) {
+			WriteLock lock(imageLock);
+			write(toAddress(header->relocationTableOffset, offset), &value, 1);
+		}
+
+		/*
+			Write a 2-byte <value> to the specified <offset> relative to the start of the relocations
+		*/
+		void writeToRelocations(uint32_t offset, uint16_t value) {
+			WriteLock lock(imageLock);
+			write(toAddress(header->relocationTableOffset, offset), &value, 1);
+		}
+
+		/*
+			Write a 1-byte <value> to the specified <offset> relative to the start of the relocations
+		*/
+		void writeToRelocations(uint32_t offset, uint8_t value) {
+			WriteLock lock(imageLock);
+			write(toAddress(header->relocationTableOffset, offset), &value, 1);
+		}
 
-			parseSectionInfoTable();
+		/*
+			Write a series of <count> 4-byte <values> to the specified <offset> relative to the start of the relocations
+		*/
+		void writeToRelocations(uint32_t offset, uint32_t *values, int32_t count) {
+			WriteLock lock(imageLock);
+			write(toAddress(header->relocationTableOffset, offset), values, count);
+		}
+
+		/*
+			Write a series of <count> 2-byte <values> to the specified <offset> relative to the start of the relocations
+		*/
+		void writeToRelocations(uint32_t offset, uint16_t *values, int32_t count) {
+			WriteLock lock(imageLock);
+			write(toAddress(header->relocationTableOffset, offset), values, count);
+		}
+
+		/*
+			Write a series of <count> 1-byte <values> to the specified <offset> relative to the start of the relocations
+		*/
+		void writeToRelocations(uint32_t offset, uint8_t *values, int32_t count) {
+			WriteLock lock(imageLock);
+			write(toAddress(header->relocationTableOffset, offset), values, count);
+		}
+
+	private:
+
+		/*
+			Converts a <raw> rel position into an absolute offset
+			This is done by zeroing out the least significant bit (the executable bit)
+		*/
+		uint32_t toAddress(uint32_t raw) {
+			return raw & (~1);
+		}
+
+		/*
+			Combines a <raw> rel position with an <offset> into an absolute offset
+			This is done by zeroing out the least significant bit (the executable bit) and adding the <offset>
+		*/
+		std::streamoff toAddress(uint32_t raw, uint32_t offset) {
+			return (std::streamoff) (int64_t)((raw & (~1)) + offset);
+		}
+
+		/*
+			Combines an absolute <offset> and a boolean of if the address <isExecutable> into a raw rel position
+		*/
+		uint32_t toSectionOffsetFormat(uint32_t offset, uint8_t isExecutable) {
+			uint32_t address = toAddress(offset);
+			uint32_t orValue = address | isExecutable;
+			return orValue;
+		}
+
+		/*
+			The code cave allocator, rescanned if anything it depends on changed since the last scan
+			Space that was already allocated is kept out of the new scan
+		*/
+		CodeCaveAllocator& codeCaves() {
+			if (codeCavesStale || relocationIndexStale.load(std::memory_order_relaxed)) {
+				std::vector<CodeCave> caves;
+				scanCodeCaves(codeCaveMinimumSize, caves);
+				codeCaveAllocator = CodeCaveAllocator(caves);
+				for (size_t i = 0; i < codeCaveAllocations.size(); i++) {
+					codeCaveAllocator.reserve(codeCaveAllocations[i].first.sectionID, codeCaveAllocations[i].first.offset, codeCaveAllocations[i].second);
+				}
+				codeCavesStale = false;
+			}
+			return codeCaveAllocator;
+		}
+
+		/*
+			Finds the code caves of at least <minimumSize> bytes (see findCodeCaves)
+		*/
+		void scanCodeCaves(uint32_t minimumSize, std::vector<CodeCave> &caves) {
+			caves.clear();
+			std::vector<LayoutBlock> blocks;
+			if (!layoutBlocks(blocks)) {
+				return;
+			}
+			uint32_t sectionCount = header->sectionCount;
+
+			// Offsets patched by relocations and offsets pointed to, per section
+			std::vector<std::vector<uint32_t>> patched(sectionCount);
+			std::vector<std::vector<uint32_t>> targets(sectionCount);
+			const RelocationIndex &index = relocations();
+			for (size_t i = 0; i < index.imports.size(); i++) {
+				const ImportRange &import = index.imports[i];
+				bool self = import.moduleID == header->moduleID;
+				for (uint32_t j = import.first; j < import.first + import.count; j++) {
+					uint8_t relocationType = index.types[j];
+					if (relocationType == (uint8_t)RelocationType::R_PPC_NONE || relocationType > (uint8_t)RelocationType::R_PPC_REL14) {
+						continue;
+					}
+					if (index.destinationSections[j] < sectionCount) {
+						patched[index.destinationSections[j]].push_back(index.destinationOffsets[j]);
+					}
+					if (self && index.sections[j] < sectionCount) {
+						targets[index.sections[j]].push_back(index.symbolOffsets[j]);
+					}
+				}
+			}
+			if (header->prologSection < sectionCount) {
+				targets[header->prologSection].push_back(header->prologFunctionOffset);
+			}
+			if (header->epilogSection < sectionCount) {
+				targets[header->epilogSection].push_back(header->epilogFunctionOffset);
+			}
+			if (header->unresolvedSection < sectionCount) {
+				targets[header->unresolvedSection].push_back(header->unresolvedFunctionOffset);
+			}
 
-			parseImportTable();
+			// Candidate ranges per section (start, end, type)
+			std::vector<std::vector<CodeCave>> candidates(sectionCount);
+			for (size_t i = 0; i < blocks.size(); i++) {
+				if (blocks[i].type != LayoutBlockType::SECTION) {
+					continue;
+				}
+				uint32_t end = blocks[i].offset + blocks[i].size;
+				uint32_t next = i + 1 < blocks.size() ? blocks[i + 1].offset : (uint32_t)image.size();
+				if (next > end) {
+					candidates[blocks[i].sectionID].push_back(makeCave(blocks[i].sectionID, blocks[i].size, next - end, CodeCaveType::PADDING));
+				}
+			}
+
+			// Same-section branches are resolved at link time, so executable sections are scanned for their targets along with the zero runs
+			std::vector<CodeCave> zeroRuns;
+			for (uint32_t i = 0; i < sectionCount; i++) {
+				if (!validSection(i) || !sectionExecutable(i)) {
+					continue;
+				}
+				uint32_t base = toAddress(sectionInfoTable[i].offset);
+				uint32_t size = sectionInfoTable[i].size;
+				uint32_t runStart = 0xFFFFFFFF;
+				uint32_t offset = 0;
+				for (; offset + 4 <= size && (uint64_t)base + offset + 4 <= image.size(); offset += 4) {
+					uint32_t instruction = readBigInt(&image[base + offset]);
+					if (instruction == 0) {
+						if (runStart == 0xFFFFFFFF) {
+							runStart = offset;
+						}
+						continue;
+					}
+					if (runStart != 0xFFFFFFFF) {
+						zeroRuns.push_back(makeCave(i, runStart, offset - runStart, CodeCaveType::ZERO_RUN));
+						runStart = 0xFFFFFFFF;
+					}
+					// Relative b/bl and bc (AA bit clear)
+					uint32_t opcode = instruction >> 26;
+					int64_t target = -1;
+					if (opcode == 18 && (instruction & 2) == 0) {
+						target = (int64_t)offset + ((int32_t)(Field24::extract(instruction) << 6) >> 6);
+					}
+					else if (opcode == 16 && (instruction & 2) == 0) {
+						target = (int64_t)offset + (int16_t)Field14::extract(instruction);
+					}
+					if (target >= 0 && target < size) {
+						targets[i].push_back((uint32_t)target);
+					}
+				}
+				if (runStart != 0xFFFFFFFF) {
+					zeroRuns.push_back(makeCave(i, runStart, offset - runStart, CodeCaveType::ZERO_RUN));
+				}
+			}
+			for (uint32_t i = 0; i < sectionCount; i++) {
+				std::sort(targets[i].begin(), targets[i].end());
+				std::sort(patched[i].begin(), patched[i].end());
+			}
+
+			for (size_t i = 0; i < zeroRuns.size(); i++) {
+				if (!targeted(targets[zeroRuns[i].sectionID], zeroRuns[i].offset, zeroRuns[i].size)) {
+					candidates[zeroRuns[i].sectionID].push_back(zeroRuns[i]);
+				}
+			}
+			for (size_t i = 0; i < symbolMap.size(); i++) {
+				Symbol const& symbol = symbolMap[i];
+				if (symbol.size < minimumSize || !validSection(symbol.sectionID) || (uint64_t)symbol.offset + symbol.size > sectionInfoTable[symbol.sectionID].size) {
+					continue;
+				}
+				if (!targeted(targets[symbol.sectionID], symbol.offset, symbol.size)) {
+					candidates[symbol.sectionID].push_back(makeCave(symbol.sectionID, symbol.offset, symbol.size, CodeCaveType::UNREFERENCED_SYMBOL));
+				}
+			}
+
+			// Merge overlapping candidates and cut out every patched word
+			for (uint32_t i = 0; i < sectionCount; i++) {
+				std::vector<CodeCave> &ranges = candidates[i];
+				std::sort(ranges.begin(), ranges.end(), [](CodeCave const& a, CodeCave const& b) {
+					return a.offset < b.offset;
+				});
+				size_t r = 0;
+				while (r < ranges.size()) {
+					CodeCave merged = ranges[r];
+					uint64_t end = (uint64_t)merged.offset + merged.size;
+					for (++r; r < ranges.size() && ranges[r].offset <= end; r++) {
+						end = std::max<uint64_t>(end, (uint64_t)ranges[r].offset + ranges[r].size);
+					}
+
+					uint64_t start = merged.offset;
+					std::vector<uint32_t>::const_iterator word = std::lower_bound(patched[i].begin(), patched[i].end(), merged.offset < 3 ? 0 : merged.offset - 3);
+					for (; start < end; ++word) {
+						uint64_t pieceEnd = (word == patched[i].end() || *word >= end) ? end : *word;
+						if (pieceEnd > start && pieceEnd - start >= minimumSize) {
+							caves.push_back(makeCave(i, (uint32_t)start, (uint32_t)(pieceEnd - start), merged.type));
+						}
+						if (word == patched[i].end()) {
+							break;
+						}
+						start = std::max<uint64_t>(start, (uint64_t)*word + 4);
+					}
+				}
+			}
+			std::sort(caves.begin(), caves.end(), [](CodeCave const& a, CodeCave const& b) {
+				return a.fileOffset < b.fileOffset;
+			});
+		}
+
+		/*
+			Builds the cave of <size> bytes at <offset> in <sectionID>
+		*/
+		CodeCave makeCave(uint32_t sectionID, uint32_t offset, uint32_t size, CodeCaveType type) {
+			CodeCave cave;
+			cave.sectionID = sectionID;
+			cave.offset = offset;
+			cave.size = size;
+			cave.fileOffset = toAddress(sectionInfoTable[sectionID].offset) + offset;
+			cave.executable = sectionExecutable(sectionID);
+			cave.type = type;
+			return cave;
+		}
+
+		/*
+			Checks if any of the sorted <targets> is in the <size> bytes at <offset>
+		*/
+		static bool targeted(std::vector<uint32_t> const& targets, uint32_t offset, uint32_t size) {
+			std::vector<uint32_t>::const_iterator target = std::lower_bound(targets.begin(), targets.end(), offset);
+			return target != targets.end() && (uint64_t)*target < (uint64_t)offset + size;
+		}
+
+		/*
+			Gets a copy of the symbol <symbolName>
+			An unknown symbol gets section 0xFFFFFFFF so the section functions ignore it
+		*/
+		Symbol resolveSymbol(std::string const& symbolName) {
+			ReadLock lock(imageLock);
+			const Symbol *symbol = symbolMap.find(symbolName);
+			if (symbol == NULL) {
+				Symbol unknown = { 0xFFFFFFFF, 0, 0, NULL };
+				return unknown;
+			}
+			return *symbol;
+		}
+
+		/*
+			Checks if a <sectionID> is valid
+			A <sectionID> is valid if it exists in the rel file and has an offset other than 0
+		*/
+		bool validSection(uint32_t sectionID) {
+			if (sectionID < header->sectionCount && sectionInfoTable[sectionID].offset != 0) {
+				return true;
+			}
+			return false;
+		}
+
+		/*
+			Checks to see if the given <sectionID> is executable without taking the lock
+		*/
+		uint8_t sectionExecutable(uint32_t sectionID) {
+			if (validSection(sectionID)) {
+				return sectionInfoTable[sectionID].offset & 0x1;
+			}
+			return 0;
+		}
+
+		/*
+			Resizes <sectionID> to <newSize> without taking the lock
+			No bounds/overlap checks are done
+		*/
+		uint32_t writeSectionSize(uint32_t sectionID, uint32_t newSize) {
+			if (validSection(sectionID) && newSize > 0) {
+				// Update our stored section offset
+				sectionInfoTable[sectionID].size = newSize;
+
+				// Update the rel file's section offset
+				write(header->sectionInfoOffset + (0x8 * sectionID) + 0x4, &sectionInfoTable[sectionID].size, 1);
+
+				return sectionInfoTable[sectionID].size;
+			}
+			return 0xFFFFFFFF;
+		}
+
+		/*
+			Copies <amount> bytes from absolute address <sourceOffset> to absolute address <destinationOffset>
+			Overlapping ranges are handled since the copy is done on the in-memory image
+		*/
+		void copyData(int64_t sourceOffset, int64_t destinationOffset, int64_t amount) {
+			if (amount <= 0 || sourceOffset < 0 || sourceOffset + amount > (int64_t)image.size()) {
+				return;
+			}
+			preserve((size_t)destinationOffset, (size_t)amount);
+			if ((size_t)(destinationOffset + amount) > image.size()) {
+				image.resize((size_t)(destinationOffset + amount));
+			}
+			memmove(&image[(size_t)destinationOffset], &image[(size_t)sourceOffset], (size_t)amount);
+			invalidateRelocations(destinationOffset, (size_t)amount);
+
+			// Write the copied bytes through to the rel file
+			if (writeThrough) {
+				relFile.seekp(destinationOffset, std::fstream::beg);
+				relFile.write(&image[(size_t)destinationOffset], (std::streamsize)amount);
+			}
+		}
+
+		/*
+			Saves the pages in the absolute range [<offset>, <offset> + <amount>) to the latest snapshot before they are changed
+			Has to be called before every change to the image. Any change also clears the redo history
+		*/
+		void preserve(size_t offset, size_t amount) {
+			redoSnapshots.clear();
+			if (undoSnapshots.empty() || amount == 0) {
+				return;
+			}
+			ImageSnapshot &snapshot = undoSnapshots.back();
+			// Bytes past the size the image had at the snapshot didn't exist then, undo cuts them off
+			size_t end = std::min(offset + amount, snapshot.imageSize);
+			for (size_t page = offset / snapshotPageSize; page * snapshotPageSize < end; page++) {
+				if (snapshot.pages.find(page) == snapshot.pages.end()) {
+					snapshot.pages[page] = copyPage(page);
+				}
+			}
+		}
+
+		/*
+			Builds the view for sectionView. <lock> is the read lock the view holds on to
+		*/
+		template <typename T>
+		SectionView<const T> viewSection(uint32_t sectionID, uint32_t offset, uint32_t count, std::shared_ptr<ReadLock> const& lock) {
+			static_assert(std::alignment_of<T>::value == 1, "sectionView needs a type made of be<> fields");
+			if (!validSection(sectionID) || (uint64_t)offset + (uint64_t)count * sizeof(T) > sectionInfoTable[sectionID].size) {
+				return SectionView<const T>();
+			}
+			std::streamoff absolute = toAddress(sectionInfoTable[sectionID].offset, offset);
+			if ((uint64_t)absolute + (uint64_t)count * sizeof(T) > image.size()) {
+				return SectionView<const T>();
+			}
+			return SectionView<const T>((const T*)&image[(size_t)absolute], count, lock);
+		}
+
+		/*
+			Saves the symbols the last snapshot still needs before they are cleared and clears the redo history
+		*/
+		void preserveSymbols() {
+			redoSnapshots.clear();
+			if (undoSnapshots.empty() || undoSnapshots.back().symbolCount == 0) {
+				return;
+			}
+			ImageSnapshot &snapshot = undoSnapshots.back();
+			std::vector<SavedSymbol> saved;
+			// The symbols are cleared right after, so the ones loaded after the snapshot can be dropped first
+			symbolMap.truncate(snapshot.symbolCount);
+			symbolMap.save(0, saved);
+			saved.insert(saved.end(), snapshot.symbols.begin(), snapshot.symbols.end());
+			snapshot.symbols.swap(saved);
+			snapshot.symbolCount = 0;
+		}
+
+		/*
+			Copies the current contents of <page> (shorter than a full page at the end of the image)
+		*/
+		std::shared_ptr<const std::vector<char>> copyPage(size_t page) {
+			size_t start = page * snapshotPageSize;
+			if (start >= image.size()) {
+				return std::make_shared<const std::vector<char>>();
+			}
+			size_t end = std::min(start + snapshotPageSize, image.size());
+			return std::make_shared<const std::vector<char>>(image.begin() + start, image.begin() + end);
+		}
+
+		/*
+			Puts the pages of <snapshot> back into the image and the rel file and parses the tables again, then puts back its symbols and code cave allocations
+			Returns a snapshot holding what was replaced so the change can be taken back again
+		*/
+		ImageSnapshot restoreSnapshot(ImageSnapshot const& snapshot) {
+			ImageSnapshot replaced;
+			replaced.imageSize = image.size();
+			replaced.symbolCount = std::min(snapshot.symbolCount, symbolMap.size());
+			symbolMap.save(replaced.symbolCount, replaced.symbols);
+			symbolMap.truncate(replaced.symbolCount);
+			symbolMap.restore(snapshot.symbols);
+			replaced.codeCaveAllocations.swap(codeCaveAllocations);
+			codeCaveAllocations = snapshot.codeCaveAllocations;
+			std::map<size_t, std::shared_ptr<const std::vector<char>>>::const_iterator page;
+			for (page = snapshot.pages.begin(); page != snapshot.pages.end(); ++page) {
+				replaced.pages[page->first] = copyPage(page->first);
+			}
+			// Pages that get cut off have to be saved as well
+			for (size_t i = snapshot.imageSize / snapshotPageSize; i * snapshotPageSize < image.size(); i++) {
+				if (replaced.pages.find(i) == replaced.pages.end()) {
+					replaced.pages[i] = copyPage(i);
+				}
+			}
+
+			image.resize(snapshot.imageSize);
+			for (page = snapshot.pages.begin(); page != snapshot.pages.end(); ++page) {
+				size_t start = page->first * snapshotPageSize;
+				if (start < image.size()) {
+					memcpy(&image[start], page->second->data(), std::min(page->second->size(), image.size() - start));
+				}
+			}
+
+			if (replaced.imageSize != image.size()) {
+				rewriteFile();
+			}
+			else {
+				for (page = snapshot.pages.begin(); page != snapshot.pages.end(); ++page) {
+					flushImage((std::streamoff)(page->first * snapshotPageSize), snapshotPageSize);
+				}
+			}
+			parseRel();
+			relocationIndexStale.store(true, std::memory_order_relaxed);
+			codeCavesStale = true;
+			return replaced;
 		}
 
 		/*
-			Parses the rel file's main header
+			Reads the whole rel file into the in-memory image with a single read
 		*/
-		void parseHeader() {
-			// Save the current position and go to the beginning of the file
-			std::streamoff savePos = relFile.tellg();
+		void loadImage() {
+			relFile.seekg(0, std::fstream::end);
+			std::streamoff size = relFile.tellg();
 			relFile.seekg(0, std::fstream::beg);
 
-			header = std::make_unique<Header>();
-			header->moduleID = readBigInt(relFile);
-			header->nextModuleLink = readBigInt(relFile);
-			header->previousModuleLink = readBigInt(relFile);
-			header->sectionCount = readBigInt(relFile);
-			header->sectionInfoOffset = readBigInt(relFile);
-			header->moduleNameOffset = readBigInt(relFile);
-			header->moduleNameSize = readBigInt(relFile);
-			header->moduleVersion = readBigInt(relFile);
-			header->bssSize = readBigInt(relFile);
-			header->relocationTableOffset = readBigInt(relFile);
-			header->importTableOffset = readBigInt(relFile);
-			header->importTableSize = readBigInt(relFile);
-			header->prologSection = readBigByte(relFile);
-			header->epilogSection = readBigByte(relFile);
-			header->unresolvedSection = readBigByte(relFile);
-			header->padding = readBigByte(relFile);
-			header->prologFunctionOffset = readBigInt(relFile);
-			header->epilogFunctionOffset = readBigInt(relFile);
-			header->unresolvedFunctionOffset = readBigInt(relFile);
+			image.resize((size_t)size);
+			relFile.read(image.data(), (std::streamsize)size);
+		}
+
+		/*
+			Replaces the contents of the rel file with the in-memory image
+			Used after changes that move most of the file or make it smaller
+		*/
+		void rewriteFile() {
+			if (!writeThrough) {
+				return;
+			}
+			relFile.close();
+			relFile.open(filename, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+			relFile.write(image.data(), (std::streamsize)image.size());
+			relFile.flush();
+		}
+
+		/*
+			Applies <patches> without taking the lock (see patchInstructions)
+		*/
+		uint32_t applyInstructionPatches(std::vector<InstructionPatch> const& patches) {
+			// Pair every valid patch with the absolute offset of its instruction and sort by it
+			std::vector<std::pair<uint32_t, size_t>> order;
+			order.reserve(patches.size());
+			for (size_t i = 0; i < patches.size(); i++) {
+				InstructionPatch const& patch = patches[i];
+				if (!validSection(patch.sectionID) || (patch.offset & 3) != 0 || (uint64_t)patch.offset + 4 > sectionInfoTable[patch.sectionID].size) {
+					continue;
+				}
+				uint32_t absolute = (uint32_t)toAddress(sectionInfoTable[patch.sectionID].offset, patch.offset);
+				if ((uint64_t)absolute + 4 <= image.size()) {
+					order.push_back(std::make_pair(absolute, i));
+				}
+			}
+			std::stable_sort(order.begin(), order.end(), [](std::pair<uint32_t, size_t> const& a, std::pair<uint32_t, size_t> const& b) {
+				return a.first < b.first;
+			});
+			disableCoveredRelocations(order, patches);
+
+			uint32_t written = 0;
+			std::vector<char> run;
+			uint32_t runStart = 0;
+			size_t i = 0;
+			while (i < order.size()) {
+				uint32_t absolute = order[i].first;
+				// Start a new run of neighbouring instructions when there is a gap
+				if (!run.empty() && absolute != runStart + run.size()) {
+					writeImage(runStart, run.data(), run.size());
+					run.clear();
+				}
+				if (run.empty()) {
+					runStart = absolute;
+				}
 
-			// Version specific
-			if (header->moduleVersion > 1) {
-				header->moduleAlignment = readBigInt(relFile);
-				header->bssAlignment = readBigInt(relFile);
-				if (header->moduleVersion > 2) {
-					header->unknown = readBigInt(relFile);
+				uint32_t instruction = readBigInt(&image[absolute]);
+				for (; i < order.size() && order[i].first == absolute; i++) {
+					InstructionPatch const& patch = patches[order[i].second];
+					instruction = (instruction & ~patch.mask) | (patch.value & patch.mask);
 				}
+				run.resize(run.size() + 4);
+				writeBigInt(&run[run.size() - 4], instruction);
+				++written;
+			}
+			if (!run.empty()) {
+				writeImage(runStart, run.data(), run.size());
 			}
+			return written;
+		}
 
-			header->importTableCount = header->importTableSize >> 3;
+		/*
+			Turns every relocation that would rewrite patched bits at link time into an R_PPC_NONE entry so the patches aren't undone
+			<order> holds the absolute offset of every patched instruction (sorted) and the index of its patch
+			Only the entries patching near each instruction are looked at (through the index sorted by destination)
+			The caller must hold the unique lock
+			Returns the number of relocations disabled
+		*/
+		uint32_t disableCoveredRelocations(std::vector<std::pair<uint32_t, size_t>> const& order, std::vector<InstructionPatch> const& patches) {
+			if (order.empty()) {
+				return 0;
+			}
+			relocations();
+			relocationIndex.sortByDestination();
+			const RelocationIndex &index = relocationIndex;
+
+			std::vector<uint32_t> covered;
+			for (size_t i = 0; i < order.size(); i++) {
+				if (i > 0 && order[i].first == order[i - 1].first) {
+					continue;
+				}
+				// A relocation patches at most 4 bytes, so only entries starting up to 3 bytes before the instruction can reach into it
+				InstructionPatch const& patch = patches[order[i].second];
+				std::pair<uint32_t, uint32_t> range = index.destinationRange(patch.sectionID, patch.offset >= 3 ? patch.offset - 3 : 0, patch.offset + 4);
+				for (uint32_t k = range.first; k < range.second; k++) {
+					uint32_t j = index.destinationOrder[k];
+					uint8_t type = index.types[j];
+					if (type == (uint8_t)RelocationType::R_PPC_NONE || type > (uint8_t)RelocationType::R_PPC_REL14) {
+						continue;
+					}
+					uint32_t length = type >= (uint8_t)RelocationType::R_PPC_ADDR16 && type <= (uint8_t)RelocationType::R_PPC_ADDR16_HA ? 2 : 4;
+					uint64_t start = (uint64_t)toAddress(sectionInfoTable[patch.sectionID].offset, index.destinationOffsets[j]);
+					if (patchedBytes(order, patches, start, start + length)) {
+						covered.push_back(j);
+					}
+				}
+			}
+			std::sort(covered.begin(), covered.end());
+			covered.erase(std::unique(covered.begin(), covered.end()), covered.end());
+			disableRelocations(covered);
+			return (uint32_t)covered.size();
+		}
 
-			// Return the the previous file position
-			relFile.seekg(savePos, std::fstream::beg);
+		/*
+			Turns the relocation entries <entries> (positions in the relocation index) into R_PPC_NONE entries
+			The index is changed along with the image so it doesn't have to be decoded again, and nearby entries are written to the rel file together
+			The caller must hold the unique lock
+		*/
+		void disableRelocations(std::vector<uint32_t> const& entries) {
+			if (entries.empty()) {
+				return;
+			}
+			std::vector<uint32_t> typeOffsets;
+			typeOffsets.reserve(entries.size());
+			for (size_t i = 0; i < entries.size(); i++) {
+				typeOffsets.push_back(relocationIndex.absoluteOffset(relocationIndex.importOf(entries[i]), entries[i]) + 2);
+				relocationIndex.disable(entries[i]);
+			}
+			std::sort(typeOffsets.begin(), typeOffsets.end());
+
+			// Entries up to a few lines apart are flushed in one write
+			const size_t flushGap = 64;
+			size_t runStart = typeOffsets[0];
+			size_t runEnd = runStart;
+			for (size_t i = 0; i < typeOffsets.size(); i++) {
+				size_t offset = typeOffsets[i];
+				if (offset > runEnd + flushGap) {
+					flushImage(runStart, runEnd - runStart);
+					runStart = offset;
+				}
+				preserve(offset, 1);
+				writeBigByte(&image[offset], (uint8_t)RelocationType::R_PPC_NONE);
+				runEnd = offset + 1;
+			}
+			flushImage(runStart, runEnd - runStart);
+			codeCavesStale = true;
 		}
 
 		/*
-			Parses the rel file's section info table
+			Checks if the instructions in <order> change any byte from <start> up to <end> (absolute offsets)
 		*/
-		void parseSectionInfoTable() {
-			// Save the current position and go to the beginning of the file
-			std::streamoff savePos = relFile.tellg();
-			relFile.seekg((std::streamoff) header->sectionInfoOffset, std::fstream::beg);
+		static bool patchedBytes(std::vector<std::pair<uint32_t, size_t>> const& order, std::vector<InstructionPatch> const& patches, uint64_t start, uint64_t end) {
+			std::vector<std::pair<uint32_t, size_t>>::const_iterator i = std::lower_bound(order.begin(), order.end(), start & ~3ull,
+				[](std::pair<uint32_t, size_t> const& entry, uint64_t value) {
+				return entry.first < value;
+			});
+			for (; i != order.end() && i->first < end; ++i) {
+				uint32_t mask = patches[i->second].mask;
+				for (uint32_t byte = 0; byte < 4; byte++) {
+					uint64_t position = (uint64_t)i->first + byte;
+					if (position >= start && position < end && ((mask >> (24 - byte * 8)) & 0xFF) != 0) {
+						return true;
+					}
+				}
+			}
+			return false;
+		}
 
-			sectionInfoTable = std::make_unique<SectionInfoTable[]>(header->sectionCount);
+		/*
+			Resizes <sectionID> to <newSize> without taking the lock (see resizeSection)
+		*/
+		uint32_t resizeSectionInPlace(uint32_t sectionID, uint32_t newSize) {
+			if (!validSection(sectionID) || newSize == 0) {
+				return 0xFFFFFFFF;
+			}
+			if (newSize <= sectionInfoTable[sectionID].size) {
+				return writeSectionSize(sectionID, newSize);
+			}
 
-			for (uint32_t i = 0; i < header->sectionCount; i++) {
-				sectionInfoTable[i].offset = readBigInt(relFile);
-				sectionInfoTable[i].size = readBigInt(relFile);
-				//uint32_t offset = sectionInfoTable[i].offset & ((~0) ^ 0x1);
-				//if (offset <= 0x0020B448 && offset + sectionInfoTable[i].size > 0x0020B448) {
-				//	printf("OFFSET: %d\n", offset);
-				//	int x = 5;
-				//}
-				//std::cout << sectionInfoTable[i].size << std::endl;
+			std::vector<LayoutBlock> blocks;
+			if (!layoutBlocks(blocks)) {
+				return 0xFFFFFFFF;
+			}
+			uint32_t sectionStart = toAddress(sectionInfoTable[sectionID].offset);
+			uint32_t oldEnd = sectionStart + sectionInfoTable[sectionID].size;
+			uint64_t newEnd = (uint64_t)sectionStart + newSize;
+
+			// Find where the next block after the section starts
+			uint64_t nextStart = image.size();
+			for (size_t i = 0; i < blocks.size(); i++) {
+				if (blocks[i].offset >= oldEnd && !(blocks[i].type == LayoutBlockType::SECTION && blocks[i].sectionID == sectionID)) {
+					nextStart = blocks[i].offset;
+					break;
+				}
 			}
 
-			// Return the the previous file position
-			relFile.seekg(savePos, std::fstream::beg);
+			preserve(oldEnd, image.size() - oldEnd);
+			if (newEnd > nextStart) {
+				// Shift the rest of the file back in one move (moveLayoutBlock also rebases the header offsets pointing into the moved blocks)
+				uint32_t shift = alignUp((uint32_t)(newEnd - nextStart), 32);
+				image.insert(image.begin() + (size_t)nextStart, shift, 0);
+				for (size_t i = 0; i < blocks.size(); i++) {
+					if (blocks[i].offset >= nextStart && !(blocks[i].type == LayoutBlockType::SECTION && blocks[i].sectionID == sectionID)) {
+						moveLayoutBlock(blocks[i], blocks[i].offset + shift);
+					}
+				}
+			}
+			else if (newEnd > image.size()) {
+				image.resize((size_t)newEnd);
+			}
+			memset(&image[oldEnd], 0, (size_t)(newEnd - oldEnd));
+			sectionInfoTable[sectionID].size = newSize;
+			encodeTables();
+
+			// Write the header, the tables and everything from the end of the old section onwards
+			flushImage(0, headerSize());
+			flushImage(header->sectionInfoOffset, header->sectionCount * 8);
+			flushImage(header->importTableOffset, header->importTableSize);
+			flushImage(oldEnd, image.size() - oldEnd);
+			return newSize;
 		}
 
 		/*
-			Parses the rel file's section import table
+			Writes <amount> bytes of the image at the absolute <offset> to the rel file
 		*/
-		void parseImportTable() {
-			// Save the current position and go to the beginning of the file
-			std::streamoff savePos = relFile.tellg();
-			relFile.seekg((std::streamoff) header->importTableOffset, std::fstream::beg);
+		void flushImage(std::streamoff offset, size_t amount) {
+			if (offset < 0 || (size_t)offset >= image.size() || amount == 0) {
+				return;
+			}
+			amount = std::min(amount, image.size() - (size_t)offset);
+			if (writeThrough) {
+				relFile.seekp(offset, std::fstream::beg);
+				relFile.write(&image[(size_t)offset], (std::streamsize)amount);
+			}
+		}
 
-			importTable = std::make_unique<ImportTable[]>(header->importTableCount);
+		/*
+			Writes the header offsets, the section info table and the import table from the parsed tables into the image
+			The rel file itself is not updated
+		*/
+		void encodeTables() {
+			preserve(0, headerSize());
+			preserve(header->sectionInfoOffset, header->sectionCount * 8);
+			preserve(header->importTableOffset, header->importTableSize);
+			writeBigInt(&image[0x10], header->sectionInfoOffset);
+			writeBigInt(&image[0x14], header->moduleNameOffset);
+			writeBigInt(&image[0x24], header->relocationTableOffset);
+			writeBigInt(&image[0x28], header->importTableOffset);
+			writeBigInt(&image[0x2C], header->importTableSize);
+			if (header->moduleVersion > 2) {
+				writeBigInt(&image[0x48], header->fixSize);
+			}
 
+			for (uint32_t i = 0; i < header->sectionCount; i++) {
+				writeBigInt(&image[header->sectionInfoOffset + (0x8 * i)], sectionInfoTable[i].offset);
+				writeBigInt(&image[header->sectionInfoOffset + (0x8 * i) + 0x4], sectionInfoTable[i].size);
+			}
 			for (uint32_t i = 0; i < header->importTableCount; i++) {
-				importTable[i].moduleID = readBigInt(relFile);
-				importTable[i].relocationsOffset = readBigInt(relFile);
+				writeBigInt(&image[header->importTableOffset + (0x8 * i)], importTable[i].moduleID);
+				writeBigInt(&image[header->importTableOffset + (0x8 * i) + 0x4], importTable[i].relocationsOffset);
 			}
+			relocationIndexStale.store(true, std::memory_order_relaxed);
+			codeCavesStale = true;
+		}
 
-			// Return the the previous file position
-			relFile.seekg(savePos, std::fstream::beg);
+		/*
+			Size of the main header for the rel file's version
+		*/
+		uint32_t headerSize() {
+			return RELStructure::headerSize(header->moduleVersion);
 		}
 
-		/////
+		/*
+			Rounds <value> up to the next multiple of <alignment>
+		*/
+		static uint32_t alignUp(uint32_t value, uint32_t alignment) {
+			if (alignment <= 1) {
+				return value;
+			}
+			return (value + alignment - 1) / alignment * alignment;
+		}
+
+		/*
+			Where a kind of block goes when the file is laid out again
+		*/
+		static int layoutRank(LayoutBlockType type) {
+			switch (type) {
+			case LayoutBlockType::HEADER:
+				return 0;
+			case LayoutBlockType::SECTION_INFO_TABLE:
+				return 1;
+			case LayoutBlockType::SECTION:
+				return 2;
+			default:
+				return 3;
+			}
+		}
+
+		/*
+			Collects every block of data in the file sorted by offset into <blocks>
+			Section alignment is taken from the section's current offset (at most 32 bytes, at least 4 bytes for executable sections)
+			The module name isn't a block since its offset points into the separate string table (.str), not into the rel file
+			Returns false if two blocks overlap or a block goes past the end of the file
+		*/
+		bool layoutBlocks(std::vector<LayoutBlock> &blocks) {
+			blocks.clear();
+			if (!structureProblems.empty()) {
+				return false;
+			}
+			LayoutBlock block;
+			block.sectionID = 0;
+
+			block.type = LayoutBlockType::HEADER;
+			block.offset = 0;
+			block.size = headerSize();
+			block.alignment = 1;
+			blocks.push_back(block);
+
+			block.type = LayoutBlockType::SECTION_INFO_TABLE;
+			block.offset = header->sectionInfoOffset;
+			block.size = header->sectionCount * 8;
+			block.alignment = 4;
+			blocks.push_back(block);
+
+			for (uint32_t i = 0; i < header->sectionCount; i++) {
+				if (!validSection(i)) {
+					continue;
+				}
+				block.type = LayoutBlockType::SECTION;
+				block.sectionID = i;
+				block.offset = toAddress(sectionInfoTable[i].offset);
+				block.size = sectionInfoTable[i].size;
+				// The lowest set bit of the offset is the largest alignment the section is known to have
+				block.alignment = std::min<uint32_t>(block.offset & (0 - block.offset), 32);
+				if (sectionExecutable(i)) {
+					block.alignment = std::max<uint32_t>(block.alignment, 4);
+				}
+				blocks.push_back(block);
+			}
+			block.sectionID = 0;
+
+			if (header->importTableCount > 0) {
+				block.type = LayoutBlockType::IMPORT_TABLE;
+				block.offset = header->importTableOffset;
+				block.size = header->importTableSize;
+				block.alignment = 4;
+				blocks.push_back(block);
+
+				// The relocations run from the start of the relocation table to the end of the last import's relocations
+				const RelocationIndex &index = relocations();
+				uint32_t start = header->relocationTableOffset;
+				uint32_t end = header->relocationTableOffset;
+				for (size_t i = 0; i < index.imports.size(); i++) {
+					start = std::min(start, index.imports[i].relocationsOffset);
+					end = std::max(end, index.imports[i].relocationsOffset + index.imports[i].count * 8);
+				}
+				block.type = LayoutBlockType::RELOCATIONS;
+				block.offset = start;
+				block.size = end - start;
+				block.alignment = 4;
+				blocks.push_back(block);
+			}
+
+			std::sort(blocks.begin(), blocks.end(), [](LayoutBlock const& a, LayoutBlock const& b) {
+				return a.offset < b.offset;
+			});
+			for (size_t i = 0; i < blocks.size(); i++) {
+				if ((uint64_t)blocks[i].offset + blocks[i].size > image.size()) {
+					return false;
+				}
+				if (i > 0 && blocks[i].offset < blocks[i - 1].offset + blocks[i - 1].size) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		/*
+			Updates the parsed tables for <block> being placed at <newOffset>
+			encodeTables has to be called afterwards to update the image
+		*/
+		void moveLayoutBlock(LayoutBlock const& block, uint32_t newOffset) {
+			uint32_t i;
+			switch (block.type) {
+			case LayoutBlockType::SECTION_INFO_TABLE:
+				header->sectionInfoOffset = newOffset;
+				break;
+			case LayoutBlockType::SECTION:
+				sectionInfoTable[block.sectionID].offset = toSectionOffsetFormat(newOffset, sectionExecutable(block.sectionID));
+				break;
+			case LayoutBlockType::IMPORT_TABLE:
+				header->importTableOffset = newOffset;
+				break;
+			case LayoutBlockType::RELOCATIONS:
+				// Every import's relocations move by the same amount as the whole block
+				header->relocationTableOffset = header->relocationTableOffset - block.offset + newOffset;
+				// So does the v3 fixSize offset when it points into (or just past) the relocations
+				if (header->moduleVersion > 2 && header->fixSize >= block.offset && header->fixSize <= block.offset + block.size) {
+					header->fixSize = header->fixSize - block.offset + newOffset;
+				}
+				for (i = 0; i < header->importTableCount; i++) {
+					importTable[i].relocationsOffset = importTable[i].relocationsOffset - block.offset + newOffset;
+				}
+				break;
+			default:
+				break;
+			}
+		}
+
+		/*
+			Reads <amount> bytes at the absolute <offset> of the image into <buffer>
+			Bytes past the end of the image are left untouched
+		*/
+		void readImage(std::streamoff offset, char *buffer, uint32_t amount) {
+			if (offset >= 0 && (size_t)offset < image.size()) {
+				size_t available = image.size() - (size_t)offset;
+				memcpy(buffer, &image[(size_t)offset], amount < available ? amount : available);
+			}
+		}
+
+		/*
+			Writes <amount> bytes from <buffer> to the absolute <offset> of the image and through to the rel file
+			The image grows if the write goes past its end
+		*/
+		void writeImage(std::streamoff offset, const char *buffer, size_t amount) {
+			if (offset < 0 || amount == 0) {
+				return;
+			}
+			preserve((size_t)offset, amount);
+			if ((size_t)offset + amount > image.size()) {
+				image.resize((size_t)offset + amount);
+				codeCavesStale = true;
+			}
+			memcpy(&image[(size_t)offset], buffer, amount);
+			invalidateRelocations(offset, amount);
+			// Writes to the header or section info table can move or resize sections
+			if ((uint64_t)offset < (uint64_t)header->sectionInfoOffset + header->sectionCount * 8 && ((uint64_t)offset < headerSize() || (uint64_t)offset + amount > header->sectionInfoOffset)) {
+				codeCavesStale = true;
+			}
+
+			if (writeThrough) {
+				relFile.seekp(offset, std::fstream::beg);
+				relFile.write(buffer, (std::streamsize)amount);
+			}
+		}
+
+		/*
+			Write a series of <count> 4-byte <values> to the rel file at the specified <offset>
+		*/
+		void write(std::streamoff offset, uint32_t *values, int32_t count) {
+			if (count <= 0) {
+				return;
+			}
+			std::unique_ptr<char[]> buffer = std::make_unique<char[]>((size_t)count * 4);
+			for (int32_t i = 0; i < count; i++) {
+				writeBigInt(&buffer[(size_t)i * 4], values[i]);
+			}
+			writeImage(offset, buffer.get(), (size_t)count * 4);
+		}
+
+		/*
+			Write a series of <count> 2-byte <values> to the rel file at the specified <offset>
+		*/
+		void write(std::streamoff offset, uint16_t *values, int32_t count) {
+			if (count <= 0) {
+				return;
+			}
+			std::unique_ptr<char[]> buffer = std::make_unique<char[]>((size_t)count * 2);
+			for (int32_t i = 0; i < count; i++) {
+				writeBigShort(&buffer[(size_t)i * 2], values[i]);
+			}
+			writeImage(offset, buffer.get(), (size_t)count * 2);
+		}
+
+		/*
+			Write a series of <count> 1-byte <values> to the rel file at the specified <offset>
+		*/
+		void write(std::streamoff offset, uint8_t *values, int32_t count) {
+			if (count <= 0) {
+				return;
+			}
+			writeImage(offset, (const char*)values, (size_t)count);
+		}
+
+		/*
+			Parses the rel file's headers by calling other helper functions
+		*/
+		void parseRel() {
+			std::vector<SectionInfoTable> sections;
+			std::vector<ImportTable> imports;
+			header = std::make_unique<Header>();
+			RELStructure::decodeHeader(image.data(), image.size(), *header);
+			RELStructure::decodeTable(image.data(), image.size(), header->sectionInfoOffset, header->sectionCount, sections);
+			RELStructure::decodeTable(image.data(), image.size(), header->importTableOffset, header->importTableCount, imports);
+
+			// Malformed files are rejected before any work is done. Without sections or imports every function leaves the file alone
+			std::vector<uint64_t> relocationEnds = RELStructure::relocationEnds(image.data(), image.size(), imports);
+			structureProblems.clear();
+			if (!RELStructure::validate(*header, sections, imports, relocationEnds, image.size(), structureProblems) && onlySectionsPastEnd(sections)) {
+				// expandSectionUnsafe leaves a section at the end of the file larger than the file until its new space is written
+				uint64_t end = image.size();
+				for (size_t i = 0; i < sections.size(); i++) {
+					uint32_t offset = toAddress(sections[i].offset);
+					if (offset != 0) {
+						end = std::max(end, (uint64_t)offset + sections[i].size);
+					}
+				}
+				image.resize((size_t)end, 0);
+				structureProblems.clear();
+				RELStructure::validate(*header, sections, imports, relocationEnds, image.size(), structureProblems);
+			}
+			if (!structureProblems.empty()) {
+				sections.clear();
+				imports.clear();
+				header->sectionCount = 0;
+				header->importTableCount = 0;
+			}
+
+			sectionInfoTable = std::make_unique<SectionInfoTable[]>(sections.size());
+			std::copy(sections.begin(), sections.end(), sectionInfoTable.get());
+			importTable = std::make_unique<ImportTable[]>(imports.size());
+			std::copy(imports.begin(), imports.end(), importTable.get());
+		}
+
+		/*
+			Checks if every structural problem is a section that starts within or right at the end of the file but runs past its end
+		*/
+		bool onlySectionsPastEnd(std::vector<SectionInfoTable> const& sections) {
+			for (size_t i = 0; i < structureProblems.size(); i++) {
+				if (structureProblems[i].error != StructureError::SECTION_OUT_OF_FILE || toAddress(sections[structureProblems[i].index].offset) > image.size()) {
+					return false;
+				}
+			}
+			return !structureProblems.empty();
+		}
 
 		/*
 			Finds a list of relocation entries that point to <offset> within <sectionID>
@@ -609,86 +2093,84 @@ namespace RELPatch {
 			Assumes sectionID is valid and <offset> is less than the size of <sectionID>
 		*/
 		std::vector<RelocationTable> findPointers(uint32_t sectionID, uint32_t offset, uint32_t tolerance) {
+			return relocations().findPointers(sectionID, offset, tolerance);
+		}
 
-			std::vector<RelocationTable> pointers;
-			uint32_t minDifference = 0xFFFFFFFF;
-
-			// Set the lower bound being careful about underflow
-			uint32_t lowerBound;
-			if (tolerance <= offset) {
-				lowerBound = offset - tolerance;
-			}
-			else {
-				lowerBound = 0;
+		/*
+			Gets the decoded relocations, decoding them again if they are out of date
+			The caller must hold at least a shared lock
+		*/
+		const RelocationIndex& relocations() {
+			if (relocationIndexStale.load(std::memory_order_acquire)) {
+				// Several readers may get here at once, only the first one rebuilds
+				std::lock_guard<std::mutex> buildLock(relocationIndexBuildLock);
+				if (relocationIndexStale.load(std::memory_order_relaxed)) {
+					relocationIndex.build(image.data(), image.size(), importTable.get(), header->importTableCount);
+					relocationIndexStale.store(false, std::memory_order_release);
+				}
 			}
-			
+			return relocationIndex;
+		}
 
+		/*
+			Appends the relocation entries for <entries> (sorted by destination) to <encoded>
+			Section switches and nops are only added where needed and an R_DOLPHIN_END entry is added at the end
+		*/
+		static void encodeRelocations(std::vector<RelocationTable> const& entries, std::vector<char> &encoded) {
+			uint32_t currentDestinationSectionID = 0xFFFFFFFF;
+			uint32_t currentDestinationOffset = 0;
 
-			// Find only relavant import tables (with the same module ID as this rel file)
-			for (uint32_t i = 0; i < header->importTableCount; i++) {
-				// Traverse the import tables relocations
-				relFile.seekg((std::streamoff) importTable[i].relocationsOffset, std::fstream::beg);
+			for (size_t i = 0; i < entries.size(); i++) {
+				RelocationTable const& entry = entries[i];
+				if (entry.destinationSectionIndex != currentDestinationSectionID) {
+					appendRelocation(encoded, 0, (uint8_t)RelocationType::R_DOLPHIN_SECTION, entry.destinationSectionIndex, 0);
+					currentDestinationSectionID = entry.destinationSectionIndex;
+					currentDestinationOffset = 0;
+				}
+				// Gaps larger than a relative offset can hold are bridged with nops
+				uint32_t distance = entry.destinationSectionOffset - currentDestinationOffset;
+				while (distance > 0xFFFF) {
+					appendRelocation(encoded, 0xFFFF, (uint8_t)RelocationType::R_DOLPHIN_NOP, 0, 0);
+					distance -= 0xFFFF;
+				}
+				appendRelocation(encoded, (uint16_t)distance, entry.relocationType, entry.sectionIndex, entry.symbolOffset);
+				currentDestinationOffset = entry.destinationSectionOffset;
+			}
+			appendRelocation(encoded, 0, (uint8_t)RelocationType::R_DOLPHIN_END, 0, 0);
+		}
 
-				RelocationTable relTableDest;
-				relTableDest.destinationSectionIndex = 0;
-				relTableDest.destinationSectionOffset = 0;
-				
-				uint8_t currentSourceSectionID = 0;
-				uint32_t currentSourceOffset = 0;
-
-				uint8_t currentDestinationSectionID = 0;
-				uint32_t currentDestinationOffset = 0;
-
-				do{
-					relTableDest.absoluteRelocationOffset = (uint32_t) relFile.tellg();
-					relTableDest.offset = readBigShort(relFile);
-					relTableDest.relocationType = readBigByte(relFile);
-					relTableDest.sectionIndex = readBigByte(relFile);
-					relTableDest.symbolOffset = readBigInt(relFile);
-
-					currentSourceSectionID = relTableDest.sectionIndex;
-					currentSourceOffset = relTableDest.symbolOffset;
-					currentDestinationOffset += relTableDest.offset;
-
-					// We are looking for a pointer in a specific section
-					if (currentSourceSectionID == sectionID) {
-						// If we are within tolerance and this is the closest offset so far or tied with the closest
-						if (currentSourceOffset >= lowerBound && currentSourceOffset <= offset && offset - currentSourceOffset <= minDifference) {
-							// If nothing else has been this close, clear the pointer list
-							if (offset - currentSourceOffset < minDifference) {
-								minDifference = offset - currentSourceOffset;
-								pointers.clear();
-							}
-
-							// Add this pointers information to the pointer list
-							relTableDest.moduleID = importTable[i].moduleID;
-							relTableDest.destinationSectionIndex = currentDestinationSectionID;
-							relTableDest.destinationSectionOffset = currentDestinationOffset;
-							pointers.push_back(relTableDest);
-							
-							/*
-							std::cout << "Calculated symbol" << std::endl;
-							std::cout << "File Position of Relocations: " << relFile.tellg() << std::endl;
-							std::cout << "File position of pointer: " << toAddress(sectionInfoTable[currentSourceSesourceSectionIndexctionID].offset, currentSourceOffset) << std::endl;
-							std::cout << "Distance from wanted position: " << offset - currentSourceOffset << std::endl;
-							std::cout << "Section: " << (uint32_t)currentSourceSectionID << std::endl;
-							std::cout << "Offet: " << currentSourceOffset << std::endl;
-							std::cout << "Relocation Type: " << (uint32_t)relTableDest.relocationType << std::endl;
-							std::cout << "Module ID: " << i << std::endl;
-							*/
-						}
-					}
-					
-					// Determine what to do based on the relocation type
-					switch (relTableDest.relocationType) {
-					case (uint8_t)RelocationType::R_DOLPHIN_SECTION:
-						currentDestinationSectionID = relTableDest.sectionIndex;
-						currentDestinationOffset = 0;
-						break;
-					}
-				} while (relTableDest.relocationType != (uint8_t) RelocationType::R_DOLPHIN_END);
+		/*
+			Appends a single 8 byte relocation entry to <encoded>
+		*/
+		static void appendRelocation(std::vector<char> &encoded, uint16_t offset, uint8_t relocationType, uint8_t sectionIndex, uint32_t symbolOffset) {
+			size_t position = encoded.size();
+			encoded.resize(position + 8);
+			writeBigShort(&encoded[position], offset);
+			writeBigByte(&encoded[position + 2], relocationType);
+			writeBigByte(&encoded[position + 3], sectionIndex);
+			writeBigInt(&encoded[position + 4], symbolOffset);
+		}
+
+		/*
+			Marks the decoded relocations as out of date if the absolute range [<offset>, <offset> + <amount>) touches the import table or the relocations
+		*/
+		void invalidateRelocations(std::streamoff offset, size_t amount) {
+			if (relocationIndexStale.load(std::memory_order_relaxed) || !header) {
+				return;
+			}
+			uint64_t start = (uint64_t)offset;
+			uint64_t end = start + amount;
+			if (start < (uint64_t)header->importTableOffset + header->importTableSize && end > header->importTableOffset) {
+				relocationIndexStale.store(true, std::memory_order_relaxed);
+				return;
+			}
+			for (size_t i = 0; i < relocationIndex.imports.size(); i++) {
+				const ImportRange &import = relocationIndex.imports[i];
+				if (start < (uint64_t)import.relocationsOffset + (uint64_t)import.count * 8 && end > import.relocationsOffset) {
+					relocationIndexStale.store(true, std::memory_order_relaxed);
+					return;
+				}
 			}
-			return pointers;
 		}
 
 		public:
@@ -698,176 +2180,211 @@ namespace RELPatch {
 			Experimental
 		*/
 		void applyRelocations() {
-			// Save the current position and go to the beginning of the file
-			std::streamoff savePos = relFile.tellg();
-			relFile.seekg(0, std::fstream::beg);
+			ReadLock lock(imageLock);
 
 			// Create a duplicate rel to avoid breaking the original
-			std::fstream relocated("relocatedRel.rel", std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
-			if (!relocated.is_open()) {
+			std::fstream relocatedFile("relocatedRel.rel", std::ios::binary | std::ios::out | std::ios::trunc);
+			if (!relocatedFile.is_open()) {
 				std::cout << "Failed to create relocations file: " << strerror(errno) << std::endl;
 				return;
 			}
-			relocated << relFile.rdbuf();
-			relocated.flush();
-			// Return the the previous file position
-			relFile.seekg(savePos, std::fstream::beg);
-
-			uint8_t currentSourceSectionID = 0;
-			uint32_t currentSourceOffset = 0;
-
-			uint8_t currentDestinationSectionID = 0;
-			uint32_t currentDestinationOffset = 0;
+			std::vector<char> relocated(image);
 
-			uint32_t numRelocations = 0;
+			const RelocationIndex &index = relocations();
 			// Find only relavant import tables (with the same module ID as this rel file)
-			for (uint32_t i = 0; i < header->importTableCount; i++) {
+			for (size_t i = 0; i < index.imports.size(); i++) {
+				const ImportRange &import = index.imports[i];
 				// Only do patches for this rel file for now
-				if (importTable[i].moduleID == header->moduleID) {
-					RelocationTable relTableSource;
-					currentSourceSectionID = 0;
-					currentSourceOffset = 0;
-
-					std::streamoff relocationsPosition = (std::streamoff) importTable[i].relocationsOffset;
-					do {
-						// Make sure we are in the right position of the relocations
-						relocated.seekg(relocationsPosition, std::fstream::beg);
-
-						relTableSource.offset = readBigShort(relocated);
-						relTableSource.relocationType = readBigByte(relocated);
-						relTableSource.sectionIndex = readBigByte(relocated);
-						relTableSource.symbolOffset = readBigInt(relocated);
-						relocationsPosition = relocated.tellg();
-
-						currentSourceSectionID = relTableSource.sectionIndex;
-						currentSourceOffset = relTableSource.symbolOffset;
-
-						currentDestinationOffset += relTableSource.offset;
-
-						// Absolute destination/source address
-						std::streamoff destinationAddress = toAddress(sectionInfoTable[currentDestinationSectionID].offset, currentDestinationOffset);
-						std::streamoff sourceAddress = toAddress(sectionInfoTable[currentSourceSectionID].offset, currentSourceOffset);
-
-						// Declare variables used in switch
-						uint32_t existingValue;
-						uint16_t lowBits;
-						uint16_t highBits;
-						uint8_t lowByte;
-						uint32_t instructionToSymbolOffset;
-						if(relTableSource.relocationType == (uint8_t)RelocationType::R_DOLPHIN_SECTION
-							|| (validSection(currentSourceSectionID) && validSection(currentDestinationSectionID))) {
-							// Determine what to do based on the relocation type
-							switch (relTableSource.relocationType) {
-							case (uint8_t)RelocationType::R_PPC_NONE:
-								// Do nothing
-								break;
-							case (uint8_t)RelocationType::R_PPC_ADDR32:
-
-								relocated.seekg(destinationAddress, std::fstream::beg);
-
-								writeBigInt(relocated, (uint32_t)sourceAddress);
-
-								break;
-							case (uint8_t)RelocationType::R_PPC_ADDR24:
-								relocated.seekg(destinationAddress, std::fstream::beg);
-								existingValue = readBigInt(relocated);
-								relocated.seekg(destinationAddress, std::fstream::beg);
-
-								highBits = (uint16_t)((sourceAddress >> 16) & 0xFFFF);
-								lowByte = (uint8_t)(sourceAddress & 0xFF);
-
-								// and out low 2 bits of lowByte
-								lowByte = (uint8_t)(lowByte & (~3));
-								// or in the low 2 bits of existingValue
-								lowByte |= (uint8_t)(existingValue & 0b11);
-
-								writeBigByte(relocated, 0);
-								writeBigShort(relocated, highBits);
-								writeBigByte(relocated, lowByte);
-								break;
-							case (uint8_t)RelocationType::R_PPC_ADDR16_LO:
-								// Offset by two in order to reach the low 16 bits
-								relocated.seekg(destinationAddress + 2, std::fstream::beg);
-
-								lowBits = (uint16_t)(sourceAddress & 0xFFFF);
-
-								writeBigShort(relocated, lowBits);
-								break;
-							case (uint8_t)RelocationType::R_PPC_ADDR16_HI:
-								relocated.seekg(destinationAddress, std::fstream::beg);
-
-								highBits = (uint16_t)((sourceAddress >> 16) & 0xFFFF);
-
-								writeBigShort(relocated, highBits);
-								break;
-							case (uint8_t)RelocationType::R_PPC_ADDR16_HA:
-								relocated.seekg(destinationAddress, std::fstream::beg);
-
-								highBits = (uint16_t)((sourceAddress >> 16) & 0xFFFF);
-								highBits += 1; // ? High 16 bits plus 0x10000
-
-								writeBigShort(relocated, highBits);
-								break;
-							case (uint8_t)RelocationType::R_PPC_ADDR14:
-							case (uint8_t)RelocationType::R_PPC_ADDR14_BRTAKEN:
-							case (uint8_t)RelocationType::R_PPC_ADDR14_BRNTAKEN:
-								relocated.seekg(destinationAddress, std::fstream::beg);
-								existingValue = readBigInt(relocated);
-								relocated.seekg(destinationAddress, std::fstream::beg);
-
-								lowBits = (uint16_t)(sourceAddress & 0x3FFF);
-
-								// and out low 2 bits of lowBits
-								lowBits = (uint16_t)(lowBits & (~3));
-								// or in the low 2 bits of existingValue
-								lowBits |= (uint16_t)(existingValue & 0b11);
-
-								writeBigShort(relocated, 0);
-								writeBigShort(relocated, lowBits);
-
-								break;
-							case (uint8_t)RelocationType::R_PPC_REL24:
-								relocated.seekg(destinationAddress, std::fstream::beg);
-
-								instructionToSymbolOffset = (uint32_t)(sourceAddress - relocationsPosition);
-
-								highBits = (uint16_t)((instructionToSymbolOffset >> 16) & 0xFFFF);
-								lowByte = (uint8_t)(instructionToSymbolOffset & 0xFF);
-
-								writeBigByte(relocated, 0);
-								writeBigShort(relocated, highBits);
-								writeBigByte(relocated, lowByte);
-								break;
-							case (uint8_t)RelocationType::R_PPC_REL14:
-								relocated.seekg(destinationAddress, std::fstream::beg);
-
-								instructionToSymbolOffset = (uint32_t)(sourceAddress - relocationsPosition);
-
-								lowBits = (uint16_t)(instructionToSymbolOffset & 0x3FFF);
-
-								writeBigShort(relocated, 0);
-								writeBigShort(relocated, lowBits);
-								break;
-							case (uint8_t)RelocationType::R_DOLPHIN_NOP:
-								// Do nothing
-								break;
-							case (uint8_t)RelocationType::R_DOLPHIN_SECTION:
-								currentDestinationSectionID = relTableSource.sectionIndex;
-								currentDestinationOffset = 0;
-								break;
-							case (uint8_t)RelocationType::R_DOLPHIN_END:
-
-								break;
-							}
-						}
-						++numRelocations;
-						if (numRelocations % 5000 == 0) {
-							//std::cout << "Completed " << numRelocations << " Relocations" << std::endl;
-						}
-					} while (relTableSource.relocationType != (uint8_t)RelocationType::R_DOLPHIN_END);
+				if (import.moduleID != header->moduleID) {
+					continue;
+				}
+				uint32_t end = import.first + import.count;
+				for (uint32_t j = import.first; j < end; j++) {
+					uint8_t currentSourceSectionID = index.sections[j];
+					uint8_t currentDestinationSectionID = index.destinationSections[j];
+					if (!validSection(currentSourceSectionID) || !validSection(currentDestinationSectionID)) {
+						continue;
+					}
+
+					// Absolute destination/source address
+					std::streamoff destinationAddress = toAddress(sectionInfoTable[currentDestinationSectionID].offset, index.destinationOffsets[j]);
+					std::streamoff sourceAddress = toAddress(sectionInfoTable[currentSourceSectionID].offset, index.symbolOffsets[j]);
+					// Absolute position just past this relocation entry
+					std::streamoff relocationsPosition = (std::streamoff)index.absoluteOffset(import, j) + 8;
+					if (destinationAddress < 0 || (size_t)destinationAddress + 4 > relocated.size()) {
+						continue;
+					}
+					char *destination = &relocated[(size_t)destinationAddress];
+
+					// Declare variables used in switch
+					uint32_t existingValue;
+					uint16_t lowBits;
+					uint16_t highBits;
+					uint8_t lowByte;
+					uint32_t instructionToSymbolOffset;
+					// Determine what to do based on the relocation type
+					switch (index.types[j]) {
+					case (uint8_t)RelocationType::R_PPC_ADDR32:
+						writeBigInt(destination, (uint32_t)sourceAddress);
+						break;
+					case (uint8_t)RelocationType::R_PPC_ADDR24:
+						existingValue = readBigInt(destination);
+
+						highBits = (uint16_t)((sourceAddress >> 16) & 0xFFFF);
+						lowByte = (uint8_t)(sourceAddress & 0xFF);
+
+						// and out low 2 bits of lowByte
+						lowByte = (uint8_t)(lowByte & (~3));
+						// or in the low 2 bits of existingValue
+						lowByte |= (uint8_t)(existingValue & 0b11);
+
+						writeBigByte(destination, 0);
+						writeBigShort(destination + 1, highBits);
+						writeBigByte(destination + 3, lowByte);
+						break;
+					case (uint8_t)RelocationType::R_PPC_ADDR16_LO:
+						// Offset by two in order to reach the low 16 bits
+						lowBits = (uint16_t)(sourceAddress & 0xFFFF);
+
+						writeBigShort(destination + 2, lowBits);
+						break;
+					case (uint8_t)RelocationType::R_PPC_ADDR16_HI:
+						highBits = (uint16_t)((sourceAddress >> 16) & 0xFFFF);
+
+						writeBigShort(destination, highBits);
+						break;
+					case (uint8_t)RelocationType::R_PPC_ADDR16_HA:
+						highBits = (uint16_t)((sourceAddress >> 16) & 0xFFFF);
+						highBits += 1; // ? High 16 bits plus 0x10000
+
+						writeBigShort(destination, highBits);
+						break;
+					case (uint8_t)RelocationType::R_PPC_ADDR14:
+					case (uint8_t)RelocationType::R_PPC_ADDR14_BRTAKEN:
+					case (uint8_t)RelocationType::R_PPC_ADDR14_BRNTAKEN:
+						existingValue = readBigInt(destination);
+
+						lowBits = (uint16_t)(sourceAddress & 0x3FFF);
+
+						// and out low 2 bits of lowBits
+						lowBits = (uint16_t)(lowBits & (~3));
+						// or in the low 2 bits of existingValue
+						lowBits |= (uint16_t)(existingValue & 0b11);
+
+						writeBigShort(destination, 0);
+						writeBigShort(destination + 2, lowBits);
+						break;
+					case (uint8_t)RelocationType::R_PPC_REL24:
+						instructionToSymbolOffset = (uint32_t)(sourceAddress - relocationsPosition);
+
+						highBits = (uint16_t)((instructionToSymbolOffset >> 16) & 0xFFFF);
+						lowByte = (uint8_t)(instructionToSymbolOffset & 0xFF);
+
+						writeBigByte(destination, 0);
+						writeBigShort(destination + 1, highBits);
+						writeBigByte(destination + 3, lowByte);
+						break;
+					case (uint8_t)RelocationType::R_PPC_REL14:
+						instructionToSymbolOffset = (uint32_t)(sourceAddress - relocationsPosition);
+
+						lowBits = (uint16_t)(instructionToSymbolOffset & 0x3FFF);
+
+						writeBigShort(destination, 0);
+						writeBigShort(destination + 2, lowBits);
+						break;
+					default:
+						// R_PPC_NONE, R_DOLPHIN_NOP, R_DOLPHIN_SECTION and R_DOLPHIN_END don't patch anything
+						break;
+					}
 				}
 			}
 
+			relocatedFile.write(relocated.data(), (std::streamsize)relocated.size());
+		}
+
+		/*
+			Builds the module as it looks in memory after being linked at <baseAddress> (rounded up to the module alignment)
+			Sections stay at their offsets from the base, the BSS is zero-filled after the file aligned to the BSS alignment,
+			the section info table and prolog/epilog/unresolved offsets are turned into addresses and the relocations
+			against this module and the DOL are applied to absolute addresses
+		*/
+		LoadedImage buildLoadedImage(uint32_t baseAddress) {
+			ReadLock lock(imageLock);
+			LoadedImage loaded;
+
+			uint32_t moduleAlignment = header->moduleVersion > 1 && header->moduleAlignment > 0 ? header->moduleAlignment : 32;
+			uint32_t bssAlignment = header->moduleVersion > 1 && header->bssAlignment > 0 ? header->bssAlignment : 32;
+			loaded.baseAddress = alignUp(baseAddress, moduleAlignment);
+			loaded.bssAddress = alignUp(loaded.baseAddress + (uint32_t)image.size(), bssAlignment);
+			loaded.bssSize = header->bssSize;
+
+			// One allocation for the module and its BSS
+			loaded.data.assign((size_t)(loaded.bssAddress - loaded.baseAddress) + loaded.bssSize, 0);
+			memcpy(loaded.data.data(), image.data(), image.size());
+
+			loaded.sectionAddresses.assign(header->sectionCount, 0);
+			for (uint32_t i = 0; i < header->sectionCount; i++) {
+				uint32_t address = 0;
+				if (validSection(i)) {
+					address = loaded.baseAddress + toAddress(sectionInfoTable[i].offset);
+					writeBigInt(&loaded.data[header->sectionInfoOffset + (0x8 * i)], toSectionOffsetFormat(address, sectionExecutable(i)));
+				}
+				else if (sectionInfoTable[i].size > 0) {
+					// A section without an offset is the BSS
+					address = loaded.bssAddress;
+					writeBigInt(&loaded.data[header->sectionInfoOffset + (0x8 * i)], address);
+				}
+				loaded.sectionAddresses[i] = address;
+			}
+			if (header->prologSection < header->sectionCount) {
+				writeBigInt(&loaded.data[0x34], loaded.sectionAddresses[header->prologSection] + header->prologFunctionOffset);
+			}
+			if (header->epilogSection < header->sectionCount) {
+				writeBigInt(&loaded.data[0x38], loaded.sectionAddresses[header->epilogSection] + header->epilogFunctionOffset);
+			}
+			if (header->unresolvedSection < header->sectionCount) {
+				writeBigInt(&loaded.data[0x3C], loaded.sectionAddresses[header->unresolvedSection] + header->unresolvedFunctionOffset);
+			}
+
+			const RelocationIndex &index = relocations();
+			for (size_t i = 0; i < index.imports.size(); i++) {
+				const ImportRange &import = index.imports[i];
+				bool isThisModule = import.moduleID == header->moduleID;
+				uint32_t end = import.first + import.count;
+				for (uint32_t j = import.first; j < end; j++) {
+					uint8_t type = index.types[j];
+					if (type == (uint8_t)RelocationType::R_PPC_NONE || type >= (uint8_t)RelocationType::R_DOLPHIN_NOP) {
+						continue;
+					}
+					// Only the addresses of this module and the DOL (module 0, whose symbols are absolute) are known
+					if (!isThisModule && import.moduleID != 0) {
+						++loaded.skippedRelocations;
+						continue;
+					}
+					uint32_t symbolAddress = index.symbolOffsets[j];
+					if (isThisModule) {
+						if (index.sections[j] >= header->sectionCount || loaded.sectionAddresses[index.sections[j]] == 0) {
+							++loaded.skippedRelocations;
+							continue;
+						}
+						symbolAddress += loaded.sectionAddresses[index.sections[j]];
+					}
+					uint8_t destinationSectionID = index.destinationSections[j];
+					if (!validSection(destinationSectionID)) {
+						++loaded.skippedRelocations;
+						continue;
+					}
+					uint32_t destinationAddress = loaded.sectionAddresses[destinationSectionID] + index.destinationOffsets[j];
+					if (!loaded.contains(destinationAddress, 4)) {
+						++loaded.skippedRelocations;
+						continue;
+					}
+					if (relocate(loaded.at(destinationAddress), type, destinationAddress, symbolAddress)) {
+						++loaded.appliedRelocations;
+					}
+				}
+			}
+			return loaded;
 		}
 	};
-}
\ No newline at end of file
+}
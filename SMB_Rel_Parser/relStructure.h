@@ -0,0 +1,347 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "structs.h"
+#include "fileFunctions.h"
+
+namespace RELPatch {
+
+	// Not in the actual specs
+	enum class StructureError {
+		HEADER_TRUNCATED,					// The file is smaller than the header of its version
+		UNSUPPORTED_VERSION,				// The module version isn't 1, 2 or 3
+		SECTION_TABLE_OUT_OF_FILE,			// The section info table goes past the end of the file
+		SECTION_OUT_OF_FILE,				// A section goes past the end of the file
+		SECTIONS_OVERLAP,					// Two sections share bytes
+		SECTION_OVERLAPS_TABLES,			// A section shares bytes with the header, the section info table or the import table
+		TABLES_OVERLAP,						// The header, the section info table and the import table share bytes
+		IMPORT_TABLE_SIZE,					// The import table size isn't a multiple of 8
+		IMPORT_TABLE_OUT_OF_FILE,			// The import table goes past the end of the file
+		RELOCATIONS_OUT_OF_FILE,			// The relocation table or an import's relocations start past the end of the file
+		RELOCATIONS_OVERLAP,				// An import's relocations share bytes with a section, the header, a table or another import's relocations
+	};
+
+	// Not in the actual specs
+	typedef struct StructureProblem {
+		StructureError error;				// What is wrong
+		uint32_t index;						// Section or import the problem is about (the first one for overlaps, 0 otherwise)
+	}StructureProblem;
+
+	// Not in the actual specs
+	typedef struct RELMetadata {
+		uint64_t fileSize;								// Size of the rel file
+		Header header;									// Decoded header
+		std::vector<SectionInfoTable> sections;			// Section info table (empty if it's outside of the file)
+		std::vector<ImportTable> imports;				// Import table (empty if it's outside of the file)
+		std::vector<StructureProblem> problems;			// Everything validate found wrong
+	}RELMetadata;
+
+	/*
+		Decoding and structural checks of the header and tables of a rel file
+		Everything works on buffers, so a whole rel file or just its first bytes can be checked before any other work is done
+	*/
+	class RELStructure {
+	public:
+		/*
+			Size of the header of <moduleVersion>
+		*/
+		static uint32_t headerSize(uint32_t moduleVersion) {
+			if (moduleVersion > 2) {
+				return 0x4C;
+			}
+			if (moduleVersion > 1) {
+				return 0x48;
+			}
+			return 0x40;
+		}
+
+		/*
+			Decodes the header from the first <size> bytes of <data>
+			Returns false if the buffer is smaller than the header (fields past its end are left 0)
+		*/
+		static bool decodeHeader(const char *data, size_t size, Header &header) {
+			memset(&header, 0, sizeof(header));
+			if (size < 0x40) {
+				return false;
+			}
+			header.moduleID = readBigInt(&data[0x00]);
+			header.nextModuleLink = readBigInt(&data[0x04]);
+			header.previousModuleLink = readBigInt(&data[0x08]);
+			header.sectionCount = readBigInt(&data[0x0C]);
+			header.sectionInfoOffset = readBigInt(&data[0x10]);
+			header.moduleNameOffset = readBigInt(&data[0x14]);
+			header.moduleNameSize = readBigInt(&data[0x18]);
+			header.moduleVersion = readBigInt(&data[0x1C]);
+			header.bssSize = readBigInt(&data[0x20]);
+			header.relocationTableOffset = readBigInt(&data[0x24]);
+			header.importTableOffset = readBigInt(&data[0x28]);
+			header.importTableSize = readBigInt(&data[0x2C]);
+			header.prologSection = readBigByte(&data[0x30]);
+			header.epilogSection = readBigByte(&data[0x31]);
+			header.unresolvedSection = readBigByte(&data[0x32]);
+			header.padding = readBigByte(&data[0x33]);
+			header.prologFunctionOffset = readBigInt(&data[0x34]);
+			header.epilogFunctionOffset = readBigInt(&data[0x38]);
+			header.unresolvedFunctionOffset = readBigInt(&data[0x3C]);
+			header.importTableCount = header.importTableSize >> 3;
+
+			// Version specific
+			if (size < headerSize(header.moduleVersion)) {
+				return false;
+			}
+			if (header.moduleVersion > 1) {
+				header.moduleAlignment = readBigInt(&data[0x40]);
+				header.bssAlignment = readBigInt(&data[0x44]);
+				if (header.moduleVersion > 2) {
+					header.fixSize = readBigInt(&data[0x48]);
+				}
+			}
+			return true;
+		}
+
+		/*
+			Decodes <count> 8-byte entries (section info or import table) starting at <offset> of the <size> bytes of <data>
+			Returns false (decoding nothing) if the entries go past the end of the buffer
+		*/
+		template <typename T>
+		static bool decodeTable(const char *data, size_t size, uint32_t offset, uint32_t count, std::vector<T> &table) {
+			static_assert(sizeof(T) == 8, "decodeTable decodes pairs of 4-byte fields");
+			table.clear();
+			if ((uint64_t)offset + (uint64_t)count * 8 > size) {
+				return false;
+			}
+			table.resize(count);
+			const char *position = data + offset;
+			for (uint32_t i = 0; i < count; i++) {
+				uint32_t fields[2] = { readBigInt(position), readBigInt(position + 4) };
+				memcpy(&table[i], fields, sizeof(fields));
+				position += 8;
+			}
+			return true;
+		}
+
+		/*
+			Checks the layout described by <header>, <sections> and <imports> against a file of <fileSize> bytes
+			<relocationEnds> holds the absolute offset just past the R_DOLPHIN_END entry of every import (see relocationsEnd)
+			Offsets past the end of the file, an import table size that isn't a multiple of 8 and sections, tables or relocations overlapping each other are reported
+			The module name isn't checked since its offset and size point into the separate string table (.str), not into the rel file
+			Returns true if nothing is wrong
+		*/
+		static bool validate(Header const& header, std::vector<SectionInfoTable> const& sections, std::vector<ImportTable> const& imports,
+				std::vector<uint64_t> const& relocationEnds, uint64_t fileSize, std::vector<StructureProblem> &problems) {
+			size_t before = problems.size();
+			uint32_t size = headerSize(header.moduleVersion);
+			if (fileSize < size) {
+				report(problems, StructureError::HEADER_TRUNCATED, 0);
+				return false;
+			}
+			if (header.moduleVersion < 1 || header.moduleVersion > 3) {
+				report(problems, StructureError::UNSUPPORTED_VERSION, 0);
+			}
+			uint64_t sectionTableEnd = (uint64_t)header.sectionInfoOffset + (uint64_t)header.sectionCount * 8;
+			if (sectionTableEnd > fileSize || sections.size() != header.sectionCount) {
+				report(problems, StructureError::SECTION_TABLE_OUT_OF_FILE, 0);
+			}
+			if (header.importTableSize % 8 != 0) {
+				report(problems, StructureError::IMPORT_TABLE_SIZE, 0);
+			}
+			if ((uint64_t)header.importTableOffset + header.importTableSize > fileSize) {
+				report(problems, StructureError::IMPORT_TABLE_OUT_OF_FILE, 0);
+			}
+			if (header.importTableCount > 0 && header.relocationTableOffset > fileSize) {
+				report(problems, StructureError::RELOCATIONS_OUT_OF_FILE, 0);
+			}
+			for (uint32_t i = 0; i < imports.size(); i++) {
+				if (imports[i].relocationsOffset >= fileSize) {
+					report(problems, StructureError::RELOCATIONS_OUT_OF_FILE, i);
+				}
+			}
+
+			// Sort every block by its start so overlaps only have to be checked between neighbors
+			std::vector<Range> ranges;
+			ranges.reserve(sections.size() + imports.size() + 3);
+			addRange(ranges, 0, size, TABLE, 0);
+			addRange(ranges, header.sectionInfoOffset, sectionTableEnd, TABLE, 0);
+			addRange(ranges, header.importTableOffset, (uint64_t)header.importTableOffset + header.importTableSize, TABLE, 0);
+			for (uint32_t i = 0; i < sections.size(); i++) {
+				uint64_t offset = sections[i].offset & ~1u;
+				if (offset == 0) {
+					continue;
+				}
+				if (offset + sections[i].size > fileSize) {
+					report(problems, StructureError::SECTION_OUT_OF_FILE, i);
+				}
+				addRange(ranges, offset, offset + sections[i].size, SECTION, i);
+			}
+			for (uint32_t i = 0; i < imports.size() && i < relocationEnds.size(); i++) {
+				addRange(ranges, imports[i].relocationsOffset, relocationEnds[i], RELOCATIONS, i);
+			}
+			std::sort(ranges.begin(), ranges.end(), [](Range const& a, Range const& b) {
+				return a.start < b.start;
+			});
+			size_t furthest = 0;
+			for (size_t i = 1; i < ranges.size(); i++) {
+				Range const& previous = ranges[furthest];
+				if (ranges[i].start < previous.end) {
+					if (previous.kind == RELOCATIONS || ranges[i].kind == RELOCATIONS) {
+						report(problems, StructureError::RELOCATIONS_OVERLAP, previous.kind == RELOCATIONS ? previous.index : ranges[i].index);
+					}
+					else if (previous.kind == SECTION && ranges[i].kind == SECTION) {
+						report(problems, StructureError::SECTIONS_OVERLAP, previous.index);
+					}
+					else if (previous.kind == SECTION || ranges[i].kind == SECTION) {
+						report(problems, StructureError::SECTION_OVERLAPS_TABLES, previous.kind == SECTION ? previous.index : ranges[i].index);
+					}
+					else {
+						report(problems, StructureError::TABLES_OVERLAP, 0);
+					}
+				}
+				if (ranges[i].end > previous.end) {
+					furthest = i;
+				}
+			}
+			return problems.size() == before;
+		}
+
+		/*
+			Finds where the relocations starting at the absolute <offset> of the <size> bytes of <data> end
+			Returns the offset just past the R_DOLPHIN_END entry, or past the last whole entry if the stream runs to the end of <data>
+		*/
+		static uint64_t relocationsEnd(const char *data, size_t size, uint32_t offset) {
+			uint64_t position = offset;
+			bool ended = false;
+			return scanRelocations(data, size, 0, position, ended);
+		}
+
+		/*
+			The end of the relocations of every import in <imports> for a file held in the <size> bytes of <data> (see relocationsEnd)
+		*/
+		static std::vector<uint64_t> relocationEnds(const char *data, size_t size, std::vector<ImportTable> const& imports) {
+			std::vector<uint64_t> ends;
+			ends.reserve(imports.size());
+			for (size_t i = 0; i < imports.size(); i++) {
+				ends.push_back(relocationsEnd(data, size, imports[i].relocationsOffset));
+			}
+			return ends;
+		}
+
+		/*
+			Reads and checks only the header and tables of the rel file <filename> (one read for the start of the file plus one per table outside of it)
+			The relocations are read up to each import's R_DOLPHIN_END so their ranges can be checked as well
+			Returns false if the file couldn't be opened
+		*/
+		static bool readMetadata(std::string const& filename, RELMetadata &metadata) {
+			std::ifstream relFile(filename, std::ios::binary | std::ios::ate);
+			if (!relFile.is_open()) {
+				return false;
+			}
+			metadata.fileSize = (uint64_t)relFile.tellg();
+			metadata.problems.clear();
+
+			// The tables usually follow the header, so the first read tends to cover them as well
+			std::vector<char> start((size_t)(metadata.fileSize < metadataReadSize ? metadata.fileSize : metadataReadSize));
+			relFile.seekg(0, std::ios::beg);
+			relFile.read(start.data(), (std::streamsize)start.size());
+			decodeHeader(start.data(), start.size(), metadata.header);
+			Header const& header = metadata.header;
+			if ((uint64_t)header.sectionInfoOffset + (uint64_t)header.sectionCount * 8 <= metadata.fileSize) {
+				readTable(relFile, start, header.sectionInfoOffset, header.sectionCount, metadata.sections);
+			}
+			if ((uint64_t)header.importTableOffset + header.importTableSize <= metadata.fileSize) {
+				readTable(relFile, start, header.importTableOffset, header.importTableCount, metadata.imports);
+			}
+			std::vector<uint64_t> ends;
+			readRelocationEnds(relFile, metadata.imports, metadata.fileSize, ends);
+			validate(metadata.header, metadata.sections, metadata.imports, ends, metadata.fileSize, metadata.problems);
+			return true;
+		}
+
+	private:
+		static const size_t metadataReadSize = 0x400;
+		static const size_t relocationReadSize = 0x1000;
+
+		enum RangeKind { TABLE, SECTION, RELOCATIONS };
+
+		typedef struct Range {
+			uint64_t start;
+			uint64_t end;
+			RangeKind kind;
+			uint32_t index;
+		}Range;
+
+		static void report(std::vector<StructureProblem> &problems, StructureError error, uint32_t index) {
+			StructureProblem problem;
+			problem.error = error;
+			problem.index = index;
+			problems.push_back(problem);
+		}
+
+		static void addRange(std::vector<Range> &ranges, uint64_t start, uint64_t end, RangeKind kind, uint32_t index) {
+			if (end <= start) {
+				return;
+			}
+			Range range;
+			range.start = start;
+			range.end = end;
+			range.kind = kind;
+			range.index = index;
+			ranges.push_back(range);
+		}
+
+		/*
+			Steps through the 8-byte relocation entries from the absolute <position> while they are within the <size> bytes of <data> starting at the absolute <dataOffset>
+			Sets <ended> once the R_DOLPHIN_END entry is passed and returns the position after the last entry stepped over
+		*/
+		static uint64_t scanRelocations(const char *data, size_t size, uint64_t dataOffset, uint64_t &position, bool &ended) {
+			while (!ended && position >= dataOffset && position + 8 <= dataOffset + size) {
+				ended = readBigByte(&data[position - dataOffset + 2]) == (uint8_t)RelocationType::R_DOLPHIN_END;
+				position += 8;
+			}
+			return position;
+		}
+
+		/*
+			Reads the relocations of every import in <imports> in chunks until its R_DOLPHIN_END entry to fill <ends> (see relocationsEnd)
+		*/
+		static void readRelocationEnds(std::ifstream &relFile, std::vector<ImportTable> const& imports, uint64_t fileSize, std::vector<uint64_t> &ends) {
+			std::vector<char> buffer(relocationReadSize);
+			ends.clear();
+			for (size_t i = 0; i < imports.size(); i++) {
+				uint64_t position = imports[i].relocationsOffset;
+				bool ended = false;
+				while (!ended && position + 8 <= fileSize) {
+					size_t amount = (size_t)std::min<uint64_t>(buffer.size(), (fileSize - position) & ~7ull);
+					relFile.clear();
+					relFile.seekg((std::streamoff)position, std::ios::beg);
+					relFile.read(buffer.data(), (std::streamsize)amount);
+					if (!relFile) {
+						break;
+					}
+					scanRelocations(buffer.data(), amount, position, position, ended);
+				}
+				ends.push_back(position);
+			}
+		}
+
+		/*
+			Decodes a table from <start> if it was covered by the first read, otherwise reads it on its own
+		*/
+		template <typename T>
+		static void readTable(std::ifstream &relFile, std::vector<char> const& start, uint32_t offset, uint32_t count, std::vector<T> &table) {
+			if (decodeTable(start.data(), start.size(), offset, count, table)) {
+				return;
+			}
+			std::vector<char> buffer((size_t)count * 8);
+			relFile.clear();
+			relFile.seekg(offset, std::ios::beg);
+			relFile.read(buffer.data(), (std::streamsize)buffer.size());
+			if (relFile) {
+				decodeTable(buffer.data(), buffer.size(), 0, count, table);
+			}
+		}
+	};
+}
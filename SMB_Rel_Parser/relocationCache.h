@@ -0,0 +1,322 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include "structs.h"
+#include "relocationIndex.h"
+
+namespace RELPatch {
+
+	// Not in the actual specs
+	typedef struct RelocationCacheKey {
+		uint64_t fileSize;					// Size of the rel file
+		int64_t modifiedTime;				// Last modification time of the rel file in nanoseconds
+		uint64_t hash;						// Hash of the header, section info table and import table of the rel file
+	}RelocationCacheKey;
+
+	/*
+		Read-only view of a whole file, mapped into memory where the platform supports it
+	*/
+	class MappedFile {
+	public:
+		MappedFile() : contents(nullptr), contentsSize(0) {}
+
+		~MappedFile() {
+#ifndef _WIN32
+			if (contents != nullptr) {
+				munmap((void*)contents, contentsSize);
+			}
+#endif
+		}
+
+		MappedFile(MappedFile const&) = delete;
+		MappedFile& operator=(MappedFile const&) = delete;
+
+		/*
+			Maps <path> (reads it into memory on Windows)
+			Returns nullptr if the file is missing or empty
+		*/
+		static std::shared_ptr<const MappedFile> open(std::string const& path) {
+			std::shared_ptr<MappedFile> file(new MappedFile());
+#ifdef _WIN32
+			std::ifstream input(path, std::ios::binary | std::ios::ate);
+			if (!input.is_open()) {
+				return nullptr;
+			}
+			std::streamoff size = input.tellg();
+			if (size <= 0) {
+				return nullptr;
+			}
+			file->buffer.resize((size_t)size);
+			input.seekg(0, std::ios::beg);
+			if (!input.read(file->buffer.data(), (std::streamsize)size)) {
+				return nullptr;
+			}
+			file->contents = file->buffer.data();
+			file->contentsSize = file->buffer.size();
+#else
+			int descriptor = ::open(path.c_str(), O_RDONLY);
+			if (descriptor < 0) {
+				return nullptr;
+			}
+			struct stat fileStatus;
+			if (fstat(descriptor, &fileStatus) != 0 || fileStatus.st_size <= 0) {
+				close(descriptor);
+				return nullptr;
+			}
+			void *mapping = mmap(nullptr, (size_t)fileStatus.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+			close(descriptor);
+			if (mapping == MAP_FAILED) {
+				return nullptr;
+			}
+			file->contents = (const char*)mapping;
+			file->contentsSize = (size_t)fileStatus.st_size;
+#endif
+			return file;
+		}
+
+		const char* data() const {
+			return contents;
+		}
+
+		size_t size() const {
+			return contentsSize;
+		}
+
+	private:
+		const char *contents;
+		size_t contentsSize;
+#ifdef _WIN32
+		std::vector<char> buffer;
+#endif
+	};
+
+	/*
+		Sidecar file holding a rel file's decoded relocation index
+		Every column is stored in host byte order right after a fixed size header. The sidecar is mapped and the index points straight into it, nothing is copied
+		The sidecar is only used if the size and modification time of the rel file and the hash of its header and tables still match
+		Only the header, section info table and import table are hashed so building the key doesn't touch the relocations or section data
+	*/
+	class RelocationCache {
+	public:
+		static const uint32_t version = 3;
+
+		/*
+			Builds the key for the rel file <filename> whose contents are <image>
+			<header> is the decoded header of the image and <headerSize> its size for the rel file's version
+		*/
+		static RelocationCacheKey key(std::string const& filename, std::vector<char> const& image, Header const& header, uint32_t headerSize) {
+			RelocationCacheKey cacheKey;
+			cacheKey.fileSize = image.size();
+			cacheKey.modifiedTime = modifiedTime(filename);
+
+			uint64_t value = hashBasis;
+			value = hashRange(image, 0, headerSize, value);
+			value = hashRange(image, header.sectionInfoOffset, (uint64_t)header.sectionCount * 8, value);
+			value = hashRange(image, header.importTableOffset, header.importTableSize, value);
+			cacheKey.hash = value;
+			return cacheKey;
+		}
+
+		/*
+			Writes <index> to the sidecar file <cachePath>
+			The sidecar is written next to <cachePath> and renamed over it so indexes still mapping the old sidecar keep valid memory
+			Returns false if the file couldn't be written
+		*/
+		static bool save(std::string const& cachePath, RelocationCacheKey const& cacheKey, RelocationIndex const& index) {
+			FileHeader fileHeader;
+			memset(&fileHeader, 0, sizeof(fileHeader));
+			memcpy(fileHeader.magic, "RELIDX", 6);
+			fileHeader.version = version;
+			fileHeader.byteOrder = byteOrderMark;
+			fileHeader.key = cacheKey;
+			fileHeader.entryCount = index.size();
+			fileHeader.importCount = (uint32_t)index.imports.size();
+
+			std::string temporaryPath = cachePath + ".tmp";
+			{
+				std::ofstream cacheFile(temporaryPath, std::ios::binary | std::ios::trunc);
+				if (!cacheFile.is_open()) {
+					return false;
+				}
+				cacheFile.write((const char*)&fileHeader, sizeof(fileHeader));
+				writeArray(cacheFile, index.imports.data(), index.imports.size());
+				writeArray(cacheFile, index.symbolOffsets.data(), index.size());
+				writeArray(cacheFile, index.destinationOffsets.data(), index.size());
+				writeArray(cacheFile, index.types.data(), index.size());
+				writeArray(cacheFile, index.sections.data(), index.size());
+				writeArray(cacheFile, index.destinationSections.data(), index.size());
+				if (!cacheFile.good()) {
+					cacheFile.close();
+					std::remove(temporaryPath.c_str());
+					return false;
+				}
+			}
+#ifdef _WIN32
+			// rename doesn't replace an existing file on Windows
+			std::remove(cachePath.c_str());
+#endif
+			if (std::rename(temporaryPath.c_str(), cachePath.c_str()) != 0) {
+				std::remove(temporaryPath.c_str());
+				return false;
+			}
+			return true;
+		}
+
+		/*
+			Maps the sidecar file <cachePath> and points <index> at it if it was written for <cacheKey>
+			Returns false (leaving <index> untouched) if the sidecar is missing, from another version or stale
+		*/
+		static bool load(std::string const& cachePath, RelocationCacheKey const& cacheKey, RelocationIndex &index) {
+			std::shared_ptr<const MappedFile> cacheFile = MappedFile::open(cachePath);
+			if (!cacheFile || cacheFile->size() < sizeof(FileHeader)) {
+				return false;
+			}
+
+			FileHeader fileHeader;
+			memcpy(&fileHeader, cacheFile->data(), sizeof(fileHeader));
+			if (memcmp(fileHeader.magic, "RELIDX", 6) != 0 || fileHeader.version != version || fileHeader.byteOrder != byteOrderMark
+				|| fileHeader.key.fileSize != cacheKey.fileSize || fileHeader.key.modifiedTime != cacheKey.modifiedTime
+				|| fileHeader.key.hash != cacheKey.hash) {
+				return false;
+			}
+			size_t entries = fileHeader.entryCount;
+			size_t expected = sizeof(FileHeader) + (size_t)fileHeader.importCount * sizeof(ImportRange)
+				+ entries * (2 * sizeof(uint32_t) + 3 * sizeof(uint8_t));
+			if (cacheFile->size() != expected) {
+				return false;
+			}
+
+			RelocationIndex loaded;
+			const char *position = cacheFile->data() + sizeof(FileHeader);
+			// The import ranges are few and are copied so they can be read without alignment concerns
+			loaded.imports.resize(fileHeader.importCount);
+			if (fileHeader.importCount > 0) {
+				memcpy(loaded.imports.data(), position, fileHeader.importCount * sizeof(ImportRange));
+			}
+			position += fileHeader.importCount * sizeof(ImportRange);
+			viewArray(position, loaded.symbolOffsets, entries);
+			viewArray(position, loaded.destinationOffsets, entries);
+			viewArray(position, loaded.types, entries);
+			viewArray(position, loaded.sections, entries);
+			viewArray(position, loaded.destinationSections, entries);
+			loaded.storage = cacheFile;
+			if (!consistent(loaded, cacheKey.fileSize)) {
+				return false;
+			}
+			index = std::move(loaded);
+			return true;
+		}
+
+		/*
+			64-bit FNV-1a style hash of <size> bytes of <data> continuing from <value>
+			The bytes are mixed in 8 at a time, only the tail is hashed byte by byte
+		*/
+		static uint64_t hash(const char *data, size_t size, uint64_t value = hashBasis) {
+			size_t i = 0;
+			for (; i + 8 <= size; i += 8) {
+				uint64_t word;
+				memcpy(&word, data + i, 8);
+				value ^= word;
+				value *= hashPrime;
+				value ^= value >> 32;
+			}
+			for (; i < size; i++) {
+				value ^= (unsigned char)data[i];
+				value *= hashPrime;
+			}
+			return value;
+		}
+
+		/*
+			Last modification time of <filename> in nanoseconds (0 if it can't be read)
+			Windows only reports whole seconds
+		*/
+		static int64_t modifiedTime(std::string const& filename) {
+#ifdef _WIN32
+			struct _stat64 fileStatus;
+			if (_stat64(filename.c_str(), &fileStatus) != 0) {
+				return 0;
+			}
+			return (int64_t)fileStatus.st_mtime * 1000000000;
+#else
+			struct stat fileStatus;
+			if (stat(filename.c_str(), &fileStatus) != 0) {
+				return 0;
+			}
+#ifdef __APPLE__
+			return (int64_t)fileStatus.st_mtimespec.tv_sec * 1000000000 + fileStatus.st_mtimespec.tv_nsec;
+#else
+			return (int64_t)fileStatus.st_mtim.tv_sec * 1000000000 + fileStatus.st_mtim.tv_nsec;
+#endif
+#endif
+		}
+
+	private:
+		static const uint32_t byteOrderMark = 0x01020304;
+		static const uint64_t hashBasis = 0xCBF29CE484222325ULL;
+		static const uint64_t hashPrime = 0x100000001B3ULL;
+
+		/*
+			Hashes the <size> bytes at <offset> of <image> (clipped to the image) into <value>
+		*/
+		static uint64_t hashRange(std::vector<char> const& image, uint64_t offset, uint64_t size, uint64_t value) {
+			if (offset >= image.size()) {
+				return value;
+			}
+			if (offset + size > image.size()) {
+				size = image.size() - offset;
+			}
+			return hash(image.data() + offset, (size_t)size, value);
+		}
+
+		typedef struct FileHeader {
+			char magic[8];					// "RELIDX"
+			uint32_t version;				// Sidecar format version
+			uint32_t byteOrder;				// byteOrderMark written in host byte order
+			RelocationCacheKey key;			// Key of the rel file the sidecar was written for
+			uint32_t entryCount;			// Number of relocation entries
+			uint32_t importCount;			// Number of import ranges
+		}FileHeader;
+
+		/*
+			Checks that the import ranges read from a sidecar stay within the entries and their relocations within a file of <fileSize> bytes
+		*/
+		static bool consistent(RelocationIndex const& index, uint64_t fileSize) {
+			for (size_t i = 0; i < index.imports.size(); i++) {
+				ImportRange const& import = index.imports[i];
+				if ((uint64_t)import.first + import.count > index.size() || (uint64_t)import.relocationsOffset + (uint64_t)import.count * 8 > fileSize) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		template <typename T>
+		static void writeArray(std::ofstream &cacheFile, T const *values, size_t count) {
+			if (count > 0) {
+				cacheFile.write((const char*)values, (std::streamsize)(count * sizeof(T)));
+			}
+		}
+
+		/*
+			Points <column> at the <count> values at <position> (the columns are laid out so every one is aligned)
+		*/
+		template <typename T>
+		static void viewArray(const char *&position, IndexColumn<T> &column, size_t count) {
+			column.view((T const*)position, count);
+			position += count * sizeof(T);
+		}
+	};
+}
@@ -0,0 +1,379 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "structs.h"
+#include "fileFunctions.h"
+
+namespace RELPatch {
+
+	typedef struct ImportRange {
+		uint32_t moduleID;					// Module ID of the import
+		uint32_t relocationsOffset;			// Absolute offset of the import's first relocation entry
+		uint32_t first;						// Index of the import's first entry in the relocation index
+		uint32_t count;						// Number of entries belonging to the import (including the R_DOLPHIN_END entry if there is one)
+	}ImportRange;
+
+	/*
+		One column of a RelocationIndex
+		The values are either owned by the column or point into memory kept alive by the index (a mapped sidecar file, see RelocationCache)
+	*/
+	template <typename T>
+	class IndexColumn {
+	public:
+		IndexColumn() : values(nullptr), count(0) {}
+
+		IndexColumn(IndexColumn const& other) {
+			copyFrom(other);
+		}
+
+		IndexColumn& operator=(IndexColumn const& other) {
+			if (this != &other) {
+				copyFrom(other);
+			}
+			return *this;
+		}
+
+		// Moving the vector keeps its buffer so the pointer stays valid
+		IndexColumn(IndexColumn &&other) : owned(std::move(other.owned)), values(other.values), count(other.count) {
+			other.values = nullptr;
+			other.count = 0;
+		}
+
+		IndexColumn& operator=(IndexColumn &&other) {
+			if (this != &other) {
+				owned = std::move(other.owned);
+				values = other.values;
+				count = other.count;
+				other.values = nullptr;
+				other.count = 0;
+			}
+			return *this;
+		}
+
+		T const& operator[](size_t index) const {
+			return values[index];
+		}
+
+		size_t size() const {
+			return count;
+		}
+
+		T const* data() const {
+			return values;
+		}
+
+		/*
+			Number of bytes allocated by the column (0 for a column pointing into a mapped file)
+		*/
+		size_t capacity() const {
+			return owned.capacity();
+		}
+
+		/*
+			Takes ownership of <column>
+		*/
+		void assign(std::vector<T> &&column) {
+			owned = std::move(column);
+			values = owned.data();
+			count = owned.size();
+		}
+
+		/*
+			Changes the value at <index>, copying a column that points into a mapped file first
+		*/
+		void set(size_t index, T value) {
+			if (values != owned.data()) {
+				owned.assign(values, values + count);
+				values = owned.data();
+			}
+			owned[index] = value;
+		}
+
+		/*
+			Points the column at <valueCount> values at <mappedValues> which must outlive the column
+		*/
+		void view(T const *mappedValues, size_t valueCount) {
+			std::vector<T>().swap(owned);
+			values = mappedValues;
+			count = valueCount;
+		}
+
+		void clear() {
+			std::vector<T>().swap(owned);
+			values = nullptr;
+			count = 0;
+		}
+
+	private:
+		std::vector<T> owned;
+		T const *values;
+		size_t count;
+
+		void copyFrom(IndexColumn const& other) {
+			if (other.owned.empty()) {
+				owned.clear();
+				values = other.values;
+			}
+			else {
+				owned = other.owned;
+				values = owned.data();
+			}
+			count = other.count;
+		}
+	};
+
+	/*
+		Decoded relocations of every import stored column by column
+		Each entry takes 11 bytes instead of the 24 bytes of a RelocationTable
+		The raw 8 byte entry and its absolute file offset can be rebuilt from the columns and the import ranges
+	*/
+	class RelocationIndex {
+	public:
+		IndexColumn<uint8_t> types;					// Relocation type of every entry
+		IndexColumn<uint8_t> sections;				// Section index of the symbol being patched to
+		IndexColumn<uint32_t> symbolOffsets;		// Section-relative (module patch) or absolute (DOL patch) offset of the symbol
+		IndexColumn<uint8_t> destinationSections;	// Section being patched (the section before the switch for R_DOLPHIN_SECTION entries)
+		IndexColumn<uint32_t> destinationOffsets;	// Offset being patched relative to the start of the destination section
+		std::vector<ImportRange> imports;			// One contiguous run of entries per import table entry
+		IndexColumn<uint32_t> destinationOrder;		// Every entry sorted by destination section and offset (filled by sortByDestination)
+		std::shared_ptr<const void> storage;		// Keeps the memory of columns that point into a mapped file alive
+
+		/*
+			Decodes the relocations of <importCount> imports from the rel file <image> of <imageSize> bytes
+		*/
+		void build(const char *image, size_t imageSize, const ImportTable *importTable, uint32_t importCount) {
+			clear();
+
+			// Count the entries first so every column is allocated exactly once
+			size_t total = 0;
+			for (uint32_t i = 0; i < importCount; i++) {
+				total += countEntries(image, imageSize, importTable[i].relocationsOffset);
+			}
+			std::vector<uint8_t> decodedTypes;
+			std::vector<uint8_t> decodedSections;
+			std::vector<uint32_t> decodedSymbolOffsets;
+			std::vector<uint8_t> decodedDestinationSections;
+			std::vector<uint32_t> decodedDestinationOffsets;
+			decodedTypes.reserve(total);
+			decodedSections.reserve(total);
+			decodedSymbolOffsets.reserve(total);
+			decodedDestinationSections.reserve(total);
+			decodedDestinationOffsets.reserve(total);
+			imports.reserve(importCount);
+
+			for (uint32_t i = 0; i < importCount; i++) {
+				ImportRange range;
+				range.moduleID = importTable[i].moduleID;
+				range.relocationsOffset = importTable[i].relocationsOffset;
+				range.first = (uint32_t)decodedTypes.size();
+
+				uint8_t currentDestinationSectionID = 0;
+				uint32_t currentDestinationOffset = 0;
+				size_t position = importTable[i].relocationsOffset;
+				while (position + 8 <= imageSize) {
+					uint8_t relocationType = readBigByte(&image[position + 2]);
+					uint8_t sectionIndex = readBigByte(&image[position + 3]);
+					currentDestinationOffset += readBigShort(&image[position]);
+
+					decodedTypes.push_back(relocationType);
+					decodedSections.push_back(sectionIndex);
+					decodedSymbolOffsets.push_back(readBigInt(&image[position + 4]));
+					decodedDestinationSections.push_back(currentDestinationSectionID);
+					decodedDestinationOffsets.push_back(currentDestinationOffset);
+					position += 8;
+
+					if (relocationType == (uint8_t)RelocationType::R_DOLPHIN_SECTION) {
+						currentDestinationSectionID = sectionIndex;
+						currentDestinationOffset = 0;
+					}
+					else if (relocationType == (uint8_t)RelocationType::R_DOLPHIN_END) {
+						break;
+					}
+				}
+				range.count = (uint32_t)decodedTypes.size() - range.first;
+				imports.push_back(range);
+			}
+			types.assign(std::move(decodedTypes));
+			sections.assign(std::move(decodedSections));
+			symbolOffsets.assign(std::move(decodedSymbolOffsets));
+			destinationSections.assign(std::move(decodedDestinationSections));
+			destinationOffsets.assign(std::move(decodedDestinationOffsets));
+		}
+
+		/*
+			Removes every entry
+		*/
+		void clear() {
+			types.clear();
+			sections.clear();
+			symbolOffsets.clear();
+			destinationSections.clear();
+			destinationOffsets.clear();
+			imports.clear();
+			destinationOrder.clear();
+			storage.reset();
+		}
+
+		/*
+			Fills destinationOrder if it isn't filled yet
+			Not thread-safe, the caller needs exclusive access to the index
+		*/
+		void sortByDestination() {
+			if (destinationOrder.size() == size()) {
+				return;
+			}
+			std::vector<uint32_t> order(size());
+			for (uint32_t i = 0; i < size(); i++) {
+				order[i] = i;
+			}
+			// Stable so entries patching the same place stay in file order
+			std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+				return destinationKey(a) < destinationKey(b);
+			});
+			destinationOrder.assign(std::move(order));
+		}
+
+		/*
+			Positions [first, second) of destinationOrder holding the entries that patch <sectionID> from <start> up to <end>
+			sortByDestination has to be called first
+		*/
+		std::pair<uint32_t, uint32_t> destinationRange(uint32_t sectionID, uint32_t start, uint32_t end) const {
+			uint64_t from = ((uint64_t)sectionID << 32) | start;
+			uint64_t to = ((uint64_t)sectionID << 32) | end;
+			const uint32_t *first = destinationOrder.data();
+			const uint32_t *last = first + destinationOrder.size();
+			const uint32_t *lower = std::lower_bound(first, last, from, [this](uint32_t entry, uint64_t key) {
+				return destinationKey(entry) < key;
+			});
+			const uint32_t *upper = std::lower_bound(lower, last, to, [this](uint32_t entry, uint64_t key) {
+				return destinationKey(entry) < key;
+			});
+			return std::make_pair((uint32_t)(lower - first), (uint32_t)(upper - first));
+		}
+
+		/*
+			The import the entry <index> belongs to (the imports hold consecutive runs of entries)
+		*/
+		const ImportRange& importOf(uint32_t index) const {
+			std::vector<ImportRange>::const_iterator next = std::upper_bound(imports.begin(), imports.end(), index, [](uint32_t value, ImportRange const& import) {
+				return value < import.first;
+			});
+			return *(next - 1);
+		}
+
+		/*
+			Turns entry <index> into an R_PPC_NONE entry (the entry's destination stays the same so destinationOrder stays sorted)
+		*/
+		void disable(uint32_t index) {
+			types.set(index, (uint8_t)RelocationType::R_PPC_NONE);
+		}
+
+		/*
+			Total number of decoded entries
+		*/
+		uint32_t size() const {
+			return (uint32_t)types.size();
+		}
+
+		/*
+			Number of bytes allocated by the index (columns pointing into a mapped file aren't counted)
+		*/
+		size_t memoryUsage() const {
+			return types.capacity() * sizeof(uint8_t)
+				+ sections.capacity() * sizeof(uint8_t)
+				+ symbolOffsets.capacity() * sizeof(uint32_t)
+				+ destinationSections.capacity() * sizeof(uint8_t)
+				+ destinationOffsets.capacity() * sizeof(uint32_t)
+				+ imports.capacity() * sizeof(ImportRange)
+				+ destinationOrder.capacity() * sizeof(uint32_t)
+				+ sizeof(RelocationIndex);
+		}
+
+		/*
+			Absolute file offset of the 8 byte entry <index> belonging to <import>
+		*/
+		uint32_t absoluteOffset(const ImportRange &import, uint32_t index) const {
+			return import.relocationsOffset + (index - import.first) * 8;
+		}
+
+		/*
+			The raw relative offset field of entry <index> belonging to <import>
+		*/
+		uint16_t relativeOffset(const ImportRange &import, uint32_t index) const {
+			if (index == import.first || types[index - 1] == (uint8_t)RelocationType::R_DOLPHIN_SECTION) {
+				return (uint16_t)destinationOffsets[index];
+			}
+			return (uint16_t)(destinationOffsets[index] - destinationOffsets[index - 1]);
+		}
+
+		/*
+			Expands entry <index> belonging to <import> into a RelocationTable
+		*/
+		RelocationTable entry(const ImportRange &import, uint32_t index) const {
+			RelocationTable relocation;
+			relocation.offset = relativeOffset(import, index);
+			relocation.relocationType = types[index];
+			relocation.sectionIndex = sections[index];
+			relocation.symbolOffset = symbolOffsets[index];
+			relocation.moduleID = import.moduleID;
+			relocation.absoluteRelocationOffset = absoluteOffset(import, index);
+			relocation.destinationSectionIndex = destinationSections[index];
+			relocation.destinationSectionOffset = destinationOffsets[index];
+			return relocation;
+		}
+
+		/*
+			Finds a list of relocation entries that point to <offset> within <sectionID> with an error range of <tolerance> bytes
+			Only the closest entries are returned
+		*/
+		std::vector<RelocationTable> findPointers(uint32_t sectionID, uint32_t offset, uint32_t tolerance) const {
+			std::vector<RelocationTable> pointers;
+			uint32_t minDifference = 0xFFFFFFFF;
+
+			// Set the lower bound being careful about underflow
+			uint32_t lowerBound = tolerance <= offset ? offset - tolerance : 0;
+
+			for (size_t i = 0; i < imports.size(); i++) {
+				const ImportRange &import = imports[i];
+				uint32_t end = import.first + import.count;
+				for (uint32_t j = import.first; j < end; j++) {
+					uint32_t symbolOffset = symbolOffsets[j];
+					if (sections[j] != sectionID || symbolOffset < lowerBound || symbolOffset > offset || offset - symbolOffset > minDifference) {
+						continue;
+					}
+					// If nothing else has been this close, clear the pointer list
+					if (offset - symbolOffset < minDifference) {
+						minDifference = offset - symbolOffset;
+						pointers.clear();
+					}
+					pointers.push_back(entry(import, j));
+				}
+			}
+			return pointers;
+		}
+
+	private:
+
+		/*
+			Counts the entries of the relocation stream starting at the absolute <position>
+		*/
+		uint64_t destinationKey(uint32_t index) const {
+			return ((uint64_t)destinationSections[index] << 32) | destinationOffsets[index];
+		}
+
+		static size_t countEntries(const char *image, size_t imageSize, size_t position) {
+			size_t count = 0;
+			while (position + 8 <= imageSize) {
+				++count;
+				if (readBigByte(&image[position + 2]) == (uint8_t)RelocationType::R_DOLPHIN_END) {
+					break;
+				}
+				position += 8;
+			}
+			return count;
+		}
+	};
+}
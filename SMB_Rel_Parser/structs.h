@@ -42,7 +42,7 @@ namespace RELPatch {
 		uint32_t unresolvedFunctionOffset;	// Section-relative offset of the unresolved function (0 if no prolog function, converted to function pointer at runtime by OSLink)
 		uint32_t moduleAlignment;			// 32 for 4-byte alignment? (v2, v3 only)
 		uint32_t bssAlignment;				// 32 for 4-byte alignment? (v2, v3 only)
-		uint32_t unknown;					// (v3 only)
+		uint32_t fixSize;					// Absolute offset into the relocations past which OSLinkFixed can free the module's memory (v3 only)
 
 		// Not in the actual specs
 		uint32_t importTableCount;			// Number of entries in the import table
@@ -72,4 +72,31 @@ namespace RELPatch {
 
 	}RelocationTable;
 
+	// Not in the actual specs
+	typedef struct RelocationOptimizationReport {
+		uint32_t bytesBefore;				// Size of the import table and relocations before optimizing
+		uint32_t bytesAfter;				// Size of the import table and relocations after optimizing
+		uint32_t entriesBefore;				// Number of relocation entries before optimizing (including section switches, nops and end markers)
+		uint32_t entriesAfter;				// Number of relocation entries after optimizing
+		uint32_t importsBefore;				// Number of imports before optimizing
+		uint32_t importsAfter;				// Number of imports after optimizing
+	}RelocationOptimizationReport;
+
+	enum class LayoutBlockType {
+		HEADER,								// The main header
+		SECTION_INFO_TABLE,					// The section info table
+		SECTION,							// The data of a section
+		IMPORT_TABLE,						// The import table
+		RELOCATIONS,						// The relocations of every import
+	};
+
+	// Not in the actual specs
+	typedef struct LayoutBlock {
+		LayoutBlockType type;				// What is stored in the block
+		uint32_t sectionID;					// Section index of a SECTION block
+		uint32_t offset;					// Absolute offset of the block
+		uint32_t size;						// Size of the block
+		uint32_t alignment;					// Required alignment of the block's offset
+	}LayoutBlock;
+
 }
\ No newline at end of file
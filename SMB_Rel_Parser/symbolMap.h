@@ -0,0 +1,419 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "structs.h"
+
+namespace RELPatch {
+
+	// Not in the actual specs
+	typedef struct Symbol {
+		uint32_t sectionID;					// Section the symbol is in
+		uint32_t offset;					// Section-relative offset of the symbol
+		uint32_t size;						// Size of the symbol in bytes (0 for labels)
+		const char *name;					// Name of the symbol (owned by the SymbolMap)
+	}Symbol;
+
+	// Not in the actual specs
+	typedef struct SymbolizedPointer {
+		RelocationTable relocation;			// The relocation entry of the pointer
+		const Symbol *symbol;				// Symbol the pointer is stored in (NULL if it isn't inside of a known symbol, valid until the symbols are cleared)
+		uint32_t symbolOffset;				// Offset of the pointer from the start of <symbol>
+	}SymbolizedPointer;
+
+	// Not in the actual specs
+	typedef struct SavedSymbol {
+		uint32_t sectionID;					// Section the symbol is in
+		uint32_t offset;					// Section-relative offset of the symbol
+		uint32_t size;						// Size of the symbol in bytes (0 for labels)
+		std::string name;					// Name of the symbol
+	}SavedSymbol;
+
+	/*
+		Symbols of a rel module loaded from linker maps or symbol files
+		Names are looked up through an open addressing hash table and addresses through a list sorted by section and offset
+		Symbols are kept in a deque and names are copied into large arena blocks, neither of which move when more maps are loaded
+		so Symbol pointers and names stay valid until clear()
+	*/
+	class SymbolMap {
+	public:
+		SymbolMap() : arenaUsed(arenaBlockSize), largestSymbol(0) {
+		}
+
+		/*
+			Loads the symbols of the linker map or symbol file <filename> (see parse)
+			Returns the number of symbols added, or 0xFFFFFFFF if the file couldn't be read
+		*/
+		uint32_t load(std::string const& filename) {
+			std::ifstream mapFile(filename, std::ios::binary | std::ios::ate);
+			if (!mapFile.is_open()) {
+				return 0xFFFFFFFF;
+			}
+			std::streamoff size = mapFile.tellg();
+			std::vector<char> text((size_t)(size > 0 ? size : 0));
+			mapFile.seekg(0, std::ios::beg);
+			mapFile.read(text.data(), (std::streamsize)text.size());
+			if (!mapFile) {
+				return 0xFFFFFFFF;
+			}
+			return parse(text.data(), text.size());
+		}
+
+		/*
+			Adds the symbols of <length> bytes of map <text> in a single pass. Two formats are understood:
+			CodeWarrior linker maps, where the entries below a "<section> section layout" header are "start size virtual [fileOffset] [alignment] name [object]"
+			Symbol files with one "sectionID offset size name" per line (offset and size in hex, # starts a comment)
+			Returns the number of symbols added
+		*/
+		uint32_t parse(const char *text, size_t length) {
+			const char *end = text + length;
+			const char *line = text;
+			uint32_t currentSection = noSection;
+			size_t before = symbols.size();
+
+			while (line < end) {
+				const char *lineEnd = (const char*)memchr(line, '\n', (size_t)(end - line));
+				if (lineEnd == NULL) {
+					lineEnd = end;
+				}
+				const char *tokens[maxTokens];
+				size_t lengths[maxTokens];
+				size_t count = tokenize(line, lineEnd, tokens, lengths);
+
+				if (count >= 3 && isWord(tokens[count - 2], lengths[count - 2], "section") && isWord(tokens[count - 1], lengths[count - 1], "layout")) {
+					currentSection = sectionID(tokens[0], lengths[0]);
+				}
+				else if (count > 0 && tokens[count - 1][lengths[count - 1] - 1] == ':') {
+					// "Memory map:", "Linker generated symbols:" and the like end a section layout
+					currentSection = noSection;
+				}
+				else if (currentSection != noSection) {
+					parseMapEntry(currentSection, tokens, lengths, count);
+				}
+				else if (count >= 4 && tokens[0][0] != '#') {
+					parseSymbolEntry(tokens, lengths);
+				}
+				line = lineEnd + 1;
+			}
+
+			buildIndex();
+			return (uint32_t)(symbols.size() - before);
+		}
+
+		/*
+			Finds the symbol called <name>
+			Returns NULL if there is no such symbol
+		*/
+		const Symbol* find(const char *name, size_t length) const {
+			if (slots.empty()) {
+				return NULL;
+			}
+			size_t mask = slots.size() - 1;
+			for (size_t slot = hash(name, length) & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+				Symbol const& symbol = symbols[slots[slot] - 1];
+				if (strncmp(symbol.name, name, length) == 0 && symbol.name[length] == '\0') {
+					return &symbol;
+				}
+			}
+			return NULL;
+		}
+
+		const Symbol* find(std::string const& name) const {
+			return find(name.c_str(), name.size());
+		}
+
+		/*
+			Finds the symbol that covers <offset> in <sectionID> (or the label placed exactly at <offset>)
+			Returns NULL if no symbol covers it
+		*/
+		const Symbol* at(uint32_t sectionID, uint32_t offset) const {
+			std::vector<uint32_t>::const_iterator position = std::upper_bound(byAddress.begin(), byAddress.end(), std::make_pair(sectionID, offset),
+				[this](std::pair<uint32_t, uint32_t> const& address, uint32_t index) {
+					return address.first < symbols[index].sectionID || (address.first == symbols[index].sectionID && address.second < symbols[index].offset);
+				});
+			// Walk back over the symbols starting at or before <offset> until none of them can be large enough to reach it
+			while (position != byAddress.begin()) {
+				Symbol const& symbol = symbols[*--position];
+				if (symbol.sectionID != sectionID || (uint64_t)symbol.offset + largestSymbol < offset) {
+					break;
+				}
+				if (offset - symbol.offset < symbol.size || (symbol.size == 0 && symbol.offset == offset)) {
+					return &symbol;
+				}
+			}
+			return NULL;
+		}
+
+		/*
+			Number of symbols loaded
+		*/
+		size_t size() const {
+			return symbols.size();
+		}
+
+		/*
+			The <index>th symbol in load order
+		*/
+		Symbol const& operator[](size_t index) const {
+			return symbols[index];
+		}
+
+		/*
+			Copies the symbols from the <first>th one on (in load order) to the end of <saved> so they can be added back with restore
+		*/
+		void save(size_t first, std::vector<SavedSymbol> &saved) const {
+			for (size_t i = first; i < symbols.size(); i++) {
+				SavedSymbol symbol;
+				symbol.sectionID = symbols[i].sectionID;
+				symbol.offset = symbols[i].offset;
+				symbol.size = symbols[i].size;
+				symbol.name = symbols[i].name;
+				saved.push_back(symbol);
+			}
+		}
+
+		/*
+			Removes the symbols loaded after the first <count>
+			Pointers to the removed symbols become invalid, the others stay in place. Their names are freed by clear()
+		*/
+		void truncate(size_t count) {
+			if (count >= symbols.size()) {
+				return;
+			}
+			symbols.resize(count);
+			largestSymbol = 0;
+			for (size_t i = 0; i < symbols.size(); i++) {
+				largestSymbol = std::max(largestSymbol, symbols[i].size);
+			}
+			buildIndex();
+		}
+
+		/*
+			Adds the symbols of <saved> after the ones loaded
+		*/
+		void restore(std::vector<SavedSymbol> const& saved) {
+			if (saved.empty()) {
+				return;
+			}
+			for (size_t i = 0; i < saved.size(); i++) {
+				addSymbol(saved[i].sectionID, saved[i].offset, saved[i].size, saved[i].name.c_str(), saved[i].name.size());
+			}
+			buildIndex();
+		}
+
+		/*
+			Removes every symbol and frees the name arena
+		*/
+		void clear() {
+			symbols.clear();
+			slots.clear();
+			byAddress.clear();
+			arena.clear();
+			arenaUsed = arenaBlockSize;
+			largestSymbol = 0;
+		}
+
+	private:
+		static const uint32_t noSection = 0xFFFFFFFF;
+		static const size_t maxTokens = 8;
+		static const size_t arenaBlockSize = 64 * 1024;
+
+		std::deque<Symbol> symbols;
+		std::vector<uint32_t> slots;						// Hash table of symbol indices + 1 (0 marks an empty slot)
+		std::vector<uint32_t> byAddress;					// Symbol indices sorted by section and offset
+		std::vector<std::unique_ptr<char[]>> arena;			// Blocks holding the names
+		size_t arenaUsed;									// Bytes used in the last arena block
+		uint32_t largestSymbol;
+
+		/*
+			Splits [<line>, <lineEnd>) on whitespace into at most maxTokens tokens
+		*/
+		static size_t tokenize(const char *line, const char *lineEnd, const char **tokens, size_t *lengths) {
+			size_t count = 0;
+			const char *position = line;
+			while (count < maxTokens) {
+				while (position < lineEnd && (*position == ' ' || *position == '\t' || *position == '\r')) {
+					++position;
+				}
+				if (position >= lineEnd) {
+					break;
+				}
+				const char *start = position;
+				while (position < lineEnd && *position != ' ' && *position != '\t' && *position != '\r') {
+					++position;
+				}
+				tokens[count] = start;
+				lengths[count] = (size_t)(position - start);
+				++count;
+			}
+			return count;
+		}
+
+		static bool isWord(const char *token, size_t length, const char *word) {
+			return strlen(word) == length && strncmp(token, word, length) == 0;
+		}
+
+		/*
+			Parses <length> characters of <token> as a hex number (with or without 0x)
+			Returns false if it isn't one
+		*/
+		static bool parseHex(const char *token, size_t length, uint32_t &value) {
+			if (length > 2 && token[0] == '0' && (token[1] == 'x' || token[1] == 'X')) {
+				token += 2;
+				length -= 2;
+			}
+			if (length == 0 || length > 8) {
+				return false;
+			}
+			value = 0;
+			for (size_t i = 0; i < length; i++) {
+				char c = token[i];
+				uint32_t digit;
+				if (c >= '0' && c <= '9') {
+					digit = (uint32_t)(c - '0');
+				}
+				else if (c >= 'a' && c <= 'f') {
+					digit = (uint32_t)(c - 'a' + 10);
+				}
+				else if (c >= 'A' && c <= 'F') {
+					digit = (uint32_t)(c - 'A' + 10);
+				}
+				else {
+					return false;
+				}
+				value = (value << 4) | digit;
+			}
+			return true;
+		}
+
+		static bool isDecimal(const char *token, size_t length) {
+			for (size_t i = 0; i < length; i++) {
+				if (token[i] < '0' || token[i] > '9') {
+					return false;
+				}
+			}
+			return length > 0;
+		}
+
+		/*
+			Section ID a CodeWarrior rel module gives to the section called <name>
+		*/
+		static uint32_t sectionID(const char *name, size_t length) {
+			static const char *const names[] = { ".text", ".ctors", ".dtors", ".rodata", ".data", ".bss" };
+			for (uint32_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+				if (isWord(name, length, names[i])) {
+					return i + 1;
+				}
+			}
+			return noSection;
+		}
+
+		/*
+			Adds the symbol of a linker map entry ("start size virtual [fileOffset] [alignment] name [object]")
+		*/
+		void parseMapEntry(uint32_t section, const char **tokens, size_t *lengths, size_t count) {
+			uint32_t offset, size, address;
+			if (count < 4 || !parseHex(tokens[0], lengths[0], offset) || !parseHex(tokens[1], lengths[1], size) || !parseHex(tokens[2], lengths[2], address)) {
+				return;
+			}
+			size_t name = 3;
+			if (lengths[name] == 8 && parseHex(tokens[name], lengths[name], address) && name + 1 < count) {
+				++name;
+			}
+			if (isDecimal(tokens[name], lengths[name]) && name + 1 < count) {
+				++name;
+			}
+			// Entries named after a section are the object file's part of the section, not a symbol
+			if (tokens[name][0] == '.') {
+				return;
+			}
+			addSymbol(section, offset, size, tokens[name], lengths[name]);
+		}
+
+		/*
+			Adds the symbol of a symbol file entry ("sectionID offset size name")
+		*/
+		void parseSymbolEntry(const char **tokens, size_t *lengths) {
+			uint32_t offset, size;
+			if (!isDecimal(tokens[0], lengths[0]) || !parseHex(tokens[1], lengths[1], offset) || !parseHex(tokens[2], lengths[2], size)) {
+				return;
+			}
+			addSymbol((uint32_t)strtoul(std::string(tokens[0], lengths[0]).c_str(), NULL, 10), offset, size, tokens[3], lengths[3]);
+		}
+
+		void addSymbol(uint32_t sectionID, uint32_t offset, uint32_t size, const char *name, size_t length) {
+			Symbol symbol;
+			symbol.sectionID = sectionID;
+			symbol.offset = offset;
+			symbol.size = size;
+			symbol.name = copyName(name, length);
+			symbols.push_back(symbol);
+			largestSymbol = std::max(largestSymbol, size);
+		}
+
+		/*
+			Copies <length> characters of <name> (plus a terminator) into the arena
+		*/
+		const char* copyName(const char *name, size_t length) {
+			if (arenaUsed + length + 1 > arenaBlockSize) {
+				arena.push_back(std::unique_ptr<char[]>(new char[length + 1 > arenaBlockSize ? length + 1 : arenaBlockSize]));
+				arenaUsed = 0;
+			}
+			char *copy = arena.back().get() + arenaUsed;
+			memcpy(copy, name, length);
+			copy[length] = '\0';
+			// Names longer than a block get a block of their own, so the next name has to start a new one
+			arenaUsed = length + 1 > arenaBlockSize ? arenaBlockSize : arenaUsed + length + 1;
+			return copy;
+		}
+
+		/*
+			Rebuilds the hash table and the address list. The first symbol loaded wins when names repeat
+		*/
+		void buildIndex() {
+			size_t capacity = 16;
+			while (capacity < symbols.size() * 2) {
+				capacity *= 2;
+			}
+			slots.assign(capacity, 0);
+			size_t mask = capacity - 1;
+			for (uint32_t i = 0; i < symbols.size(); i++) {
+				size_t length = strlen(symbols[i].name);
+				if (find(symbols[i].name, length) != NULL) {
+					continue;
+				}
+				size_t slot = hash(symbols[i].name, length) & mask;
+				while (slots[slot] != 0) {
+					slot = (slot + 1) & mask;
+				}
+				slots[slot] = i + 1;
+			}
+
+			byAddress.resize(symbols.size());
+			for (uint32_t i = 0; i < symbols.size(); i++) {
+				byAddress[i] = i;
+			}
+			std::stable_sort(byAddress.begin(), byAddress.end(), [this](uint32_t a, uint32_t b) {
+				return symbols[a].sectionID < symbols[b].sectionID || (symbols[a].sectionID == symbols[b].sectionID && symbols[a].offset < symbols[b].offset);
+			});
+		}
+
+		/*
+			32-bit FNV-1a hash of <length> characters of <name>
+		*/
+		static size_t hash(const char *name, size_t length) {
+			uint32_t value = 0x811C9DC5;
+			for (size_t i = 0; i < length; i++) {
+				value ^= (unsigned char)name[i];
+				value *= 0x01000193;
+			}
+			return value;
+		}
+	};
+}